@@ -12,6 +12,7 @@
 #include <cstdlib>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <intrin.h>
 
 // Windows things...
@@ -20,7 +21,11 @@
 #include <strsafe.h>
 #include <crtdbg.h>
 #include <Shlwapi.h>
+#include <ShlObj.h>
 #include <VersionHelpers.h>
+#include <Psapi.h>
+#include <Sddl.h>
+#include <wincrypt.h>
 
 // disabe warning C4201: nonstandard extension used: nameless struct/union
 // This program has no goal or intention of being cross-compiled or cross-platform compatible.
@@ -169,6 +174,8 @@ union Ev_ShellExecFlags {
         uint32_t    ComspecRemains      : 1;
         uint32_t    DoNotWaitForProc    : 1;
         uint32_t    HideWindow          : 1;
+        uint32_t    PseudoConsole       : 1;
+        uint32_t    NoElevate           : 1;
     };
 };
 
@@ -205,6 +212,16 @@ std::wstring xStringFormat(const WCHAR* fmt, ...)
     return result;
 }
 
+std::string ev_ToUtf8(const std::wstring& src)
+{
+    std::string result;
+    if (src.empty()) return result;
+    auto len = WideCharToMultiByte(CP_UTF8, 0, src.data(), int(src.length()), nullptr, 0, nullptr, nullptr);
+    result.resize(len);
+    WideCharToMultiByte(CP_UTF8, 0, src.data(), int(src.length()), result.data(), len, nullptr, nullptr);
+    return result;
+}
+
 HRESULT ev_GetEnvironmentVariable(const WCHAR* varname, std::wstring& dest)
 {
     WCHAR temp[xMaxEnviron];
@@ -217,6 +234,18 @@ HRESULT ev_GetEnvironmentVariable(const WCHAR* varname, std::wstring& dest)
     }
 }
 
+std::wstring ev_GetModuleFileName()
+{
+    // GetModuleFileName() has no way to query the required size, so use the same upper bound
+    // we impose on everything else.
+    std::wstring result;
+    result.resize(xMaxPath);
+    auto len = GetModuleFileName(nullptr, result.data(), xMaxPath);
+    x_abort_on(!len || len >= xMaxPath, L"GetModuleFileName() failed.\nWindows error 0x%08x", GetLastError());
+    result.resize(len);
+    return result;
+}
+
 std::wstring ev_GetCurrentDir()
 {
     auto reqsize = GetCurrentDirectory(0, nullptr);
@@ -228,6 +257,253 @@ std::wstring ev_GetCurrentDir()
 }
 
 
+// returns %LOCALAPPDATA%\eudo, creating it if needed, or an empty string if there's no such thing.
+std::wstring ev_GetLocalDataDir()
+{
+    std::wstring appdata;
+    if (ev_GetEnvironmentVariable(L"LOCALAPPDATA", appdata) || appdata.empty()) {
+        return {};
+    }
+    auto dir = appdata + L"\\eudo";
+    CreateDirectory(dir.c_str(), nullptr);
+    return dir;
+}
+
+// Launch telemetry (--stats)
+//
+// Per-phase durations are accumulated across invocations into a set of log-linear (HDR-style)
+// histograms in a file-backed shared mapping, %LOCALAPPDATA%\eudo\stats.bin.  Any number of eudo
+// processes may have it mapped at once; every update is a single interlocked operation on its own
+// 64-bit slot, so there is no lock and no process can leave the store in a torn state by dying
+// mid-update.  (A histogram's count/sum/buckets may be momentarily inconsistent with each other
+// while a writer is between increments, which is fine for percentiles.)
+//
+// Bucketing: values below 16us get one bucket each; above that every power of two is split into
+// 16 linear sub-buckets, which bounds the relative error of any reported value to ~6%.
+// All recording happens in the non-elevated caller, since that's the process doing the waiting.
+
+enum Ev_StatsPhase {
+    StatsPhase_Resolve = 0,     // PATHEXT / extension resolution
+    StatsPhase_Assoc,           // association lookup
+    StatsPhase_Elevate,         // ShellExecuteEx: UAC consent + process creation
+    StatsPhase_Child,           // child runtime, until it exits
+    StatsPhase_Total,           // wmain entry to exit
+    StatsPhase_Count
+};
+
+static const WCHAR* const xStatsPhaseNames[StatsPhase_Count] = {
+    L"resolve", L"assoc", L"elevate", L"child", L"total"
+};
+
+static const int     xStatsSubBucketBits    = 4;
+static const int     xStatsSubBuckets       = 1 << xStatsSubBucketBits;
+static const int     xStatsMaxExponent      = 40;   // 2^40 us, ~12 days
+static const int     xStatsBucketCount      = (xStatsMaxExponent - xStatsSubBucketBits + 2) * xStatsSubBuckets;
+static const LONG64  xStatsSignature        = (LONG64(0x53545545) << 32) | 1;     // 'EUTS', version 1
+
+struct Ev_StatsHistogram {
+    volatile LONG64     count;
+    volatile LONG64     sum_us;
+    volatile LONG64     max_us;
+    volatile LONG64     buckets[xStatsBucketCount];
+};
+
+struct Ev_StatsStore {
+    volatile LONG64     signature;
+    Ev_StatsHistogram   phases[StatsPhase_Count];
+};
+
+static Ev_StatsStore*   g_StatsStore    = nullptr;
+static LARGE_INTEGER    g_StatsFreq     = {};
+
+int ev_StatsBucketIndex(uint64_t us)
+{
+    if (us < xStatsSubBuckets) {
+        return int(us);
+    }
+    unsigned long msb;
+#if defined(_M_X64) || defined(_M_ARM64)
+    _BitScanReverse64(&msb, us);
+#else
+    if (us >> 32) {
+        _BitScanReverse(&msb, DWORD(us >> 32));
+        msb += 32;
+    }
+    else {
+        _BitScanReverse(&msb, DWORD(us));
+    }
+#endif
+    if (msb > xStatsMaxExponent) {
+        return xStatsBucketCount - 1;
+    }
+    int shift = int(msb) - xStatsSubBucketBits;
+    int sub   = int(us >> shift) & (xStatsSubBuckets - 1);
+    return (shift + 1) * xStatsSubBuckets + sub;
+}
+
+// returns the midpoint of the range of values covered by the bucket.
+uint64_t ev_StatsBucketValue(int idx)
+{
+    if (idx < xStatsSubBuckets) {
+        return uint64_t(idx);
+    }
+    int shift = (idx / xStatsSubBuckets) - 1;
+    int sub   =  idx % xStatsSubBuckets;
+    uint64_t low = uint64_t(xStatsSubBuckets + sub) << shift;
+    return low + ((uint64_t(1) << shift) >> 1);
+}
+
+// Maps the store into this process.  Returns null on any failure: telemetry is best-effort and
+// must never be the reason an elevation fails.
+Ev_StatsStore* ev_StatsOpen(bool createIfMissing)
+{
+    auto dir = ev_GetLocalDataDir();
+    if (dir.empty()) {
+        return nullptr;
+    }
+    auto path = dir + L"\\stats.bin";
+
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, createIfMissing ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+
+    // mapping beyond the end of the file extends it with zeroes, which is exactly an empty store.
+    HANDLE hMap = CreateFileMapping(hFile, nullptr, PAGE_READWRITE, 0, DWORD(sizeof(Ev_StatsStore)), nullptr);
+    CloseHandle(hFile);
+    if (!hMap) {
+        return nullptr;
+    }
+    auto* store = (Ev_StatsStore*)MapViewOfFile(hMap, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Ev_StatsStore));
+    CloseHandle(hMap);
+    if (!store) {
+        return nullptr;
+    }
+
+    InterlockedCompareExchange64(&store->signature, xStatsSignature, 0);
+    if (store->signature != xStatsSignature) {
+        log_error(L"WARN- %s has an unrecognized format, launch statistics are disabled.\n", path.c_str());
+        UnmapViewOfFile(store);
+        return nullptr;
+    }
+    return store;
+}
+
+int64_t ev_StatsNow()
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+void ev_StatsRecord(Ev_StatsPhase phase, int64_t startTicks)
+{
+    if (!g_StatsStore) return;
+
+    if (!g_StatsFreq.QuadPart) {
+        QueryPerformanceFrequency(&g_StatsFreq);
+    }
+    auto elapsed = ev_StatsNow() - startTicks;
+    auto us      = LONG64((elapsed * 1000000) / g_StatsFreq.QuadPart);
+    if (us < 0) us = 0;
+
+    auto& hist = g_StatsStore->phases[phase];
+    InterlockedIncrement64      (&hist.buckets[ev_StatsBucketIndex(uint64_t(us))]);
+    InterlockedExchangeAdd64    (&hist.sum_us, us);
+    InterlockedIncrement64      (&hist.count);
+
+    LONG64 prevMax = hist.max_us;
+    while (us > prevMax) {
+        auto seen = InterlockedCompareExchange64(&hist.max_us, us, prevMax);
+        if (seen == prevMax) break;
+        prevMax = seen;
+    }
+}
+
+uint64_t ev_StatsPercentile(const Ev_StatsHistogram& hist, LONG64 count, double pct)
+{
+    auto target = LONG64(pct * double(count) + 0.5);
+    if (target < 1) target = 1;
+
+    LONG64 seen = 0;
+    for (int idx=0; idx<xStatsBucketCount; ++idx) {
+        seen += hist.buckets[idx];
+        if (seen >= target) {
+            // bucket values are midpoints, which can overshoot the largest sample actually seen.
+            auto value = ev_StatsBucketValue(idx);
+            return (value > uint64_t(hist.max_us)) ? uint64_t(hist.max_us) : value;
+        }
+    }
+    return uint64_t(hist.max_us);
+}
+
+int StatsDump(const WCHAR* format)
+{
+    bool prometheus = false;
+    if (format && format[0]) {
+        if (0) { }
+        else if (wcscmp(format, L"text") == 0) {
+            prometheus = false;
+        }
+        else if (wcscmp(format, L"prometheus") == 0) {
+            prometheus = true;
+        }
+        else {
+            log_error(L"ERROR- Unrecognized --stats-dump format `%s` (expected text|prometheus)\n", format);
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto* store = ev_StatsOpen(false);
+    if (!store) {
+        log_error(L"ERROR- No launch statistics have been recorded; run eudo with --stats first.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (prometheus) {
+        log_console(
+            L"# HELP eudo_phase_duration_seconds Duration of eudo launch phases.\n"
+            L"# TYPE eudo_phase_duration_seconds summary\n"
+        );
+    }
+    else {
+        log_console(L"%-10s %10s %12s %12s %12s %12s %12s\n", L"phase", L"count", L"p50(ms)", L"p90(ms)", L"p99(ms)", L"max(ms)", L"mean(ms)");
+    }
+
+    static const double quantiles[] = { 0.50, 0.90, 0.99 };
+
+    for (int phase=0; phase<StatsPhase_Count; ++phase) {
+        const auto& hist = store->phases[phase];
+        LONG64 count = hist.count;
+        if (!count) continue;
+
+        uint64_t pvals[_countof(quantiles)];
+        for (size_t q=0; q<_countof(quantiles); ++q) {
+            pvals[q] = ev_StatsPercentile(hist, count, quantiles[q]);
+        }
+
+        if (prometheus) {
+            for (size_t q=0; q<_countof(quantiles); ++q) {
+                log_console(L"eudo_phase_duration_seconds{phase=\"%s\",quantile=\"%.2f\"} %.6f\n",
+                    xStatsPhaseNames[phase], quantiles[q], pvals[q] / 1e6);
+            }
+            log_console(L"eudo_phase_duration_seconds_sum{phase=\"%s\"} %.6f\n",   xStatsPhaseNames[phase], hist.sum_us / 1e6);
+            log_console(L"eudo_phase_duration_seconds_count{phase=\"%s\"} %lld\n", xStatsPhaseNames[phase], count);
+        }
+        else {
+            log_console(L"%-10s %10lld %12.3f %12.3f %12.3f %12.3f %12.3f\n",
+                xStatsPhaseNames[phase], count,
+                pvals[0] / 1e3, pvals[1] / 1e3, pvals[2] / 1e3,
+                hist.max_us / 1e3, (hist.sum_us / double(count)) / 1e3
+            );
+        }
+    }
+
+    UnmapViewOfFile(store);
+    return EXIT_SUCCESS;
+}
+
 std::wstring ev_AssocQueryString(ASSOCSTR str, const std::wstring& extension)
 {
     // get required buffer size by passing null, then return the result.
@@ -256,12 +532,282 @@ std::wstring ev_AssocQueryString(ASSOCSTR str, const std::wstring& extension)
 }
 
 
-int ShellExec(const WCHAR* ApplicationName, const WCHAR* CommandLine, const Ev_ShellExecFlags& flags)
+// Memoization (--memo)
+//
+// Many elevated steps are idempotent (registering a COM server, installing the same cert), so a
+// successful run can be remembered and skipped next time.  The memo key covers:
+//
+//   * the fully resolved application and command line, as handed to ShellExec
+//   * whether it was elevated at all, so a --no-elevate run never satisfies an elevated one
+//   * the current directory
+//   * the names and values of each --memo-env variable
+//   * the path, size and content hash of each --memo-input file
+//
+// A key is recorded only after the child exits with 0; a later run with the same key returns 0
+// without elevating.  Records are empty-ish marker files in %LOCALAPPDATA%\eudo\memo, one per
+// key, so concurrent eudo processes never contend on a shared store.  Delete the directory to
+// forget everything.
+//
+// Input hashing is XXH64, read through file mappings in large windows.  It is a scalar hash: the
+// four independent 64-bit lanes per 32-byte stripe give the CPU plenty of instruction-level
+// parallelism, but there is no SSE2/AVX2 64x64 multiply, so it does not vectorize.  That's fine
+// here: it's I/O bound on anything but a warm file cache.  64 bits per file is plenty against
+// accidental collisions, which is all this guards against -- it is not a security boundary, and
+// anyone who can write the memo directory could just as well skip the step themselves.
+
+static bool         g_Memo          = false;
+static ArgContainer g_MemoInputs;
+static ArgContainer g_MemoEnvNames;
+
+static const uint64_t xXXH_P1 = 11400714785074694791ULL;
+static const uint64_t xXXH_P2 = 14029467366897019727ULL;
+static const uint64_t xXXH_P3 =  1609587929392839161ULL;
+static const uint64_t xXXH_P4 =  9650029242287828579ULL;
+static const uint64_t xXXH_P5 =  2870177450012600261ULL;
+
+struct Ev_Hash64 {
+    uint64_t    v[4];
+    uint64_t    seed;
+    uint64_t    total;
+    uint8_t     tail[32];
+    uint32_t    tailSize;
+};
+
+static inline uint64_t ev_Read64(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint32_t ev_Read32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static inline uint64_t ev_XXHRound(uint64_t acc, uint64_t input)
 {
-    if (g_Verbose) {
-        log_console(L"ShellExec(\n  App  = %s\n  Args = %s\n)\n", ApplicationName, CommandLine);
+    acc += input * xXXH_P2;
+    acc  = _rotl64(acc, 31);
+    return acc * xXXH_P1;
+}
+
+static inline uint64_t ev_XXHMerge(uint64_t acc, uint64_t val)
+{
+    acc ^= ev_XXHRound(0, val);
+    return acc * xXXH_P1 + xXXH_P4;
+}
+
+void ev_Hash64Init(Ev_Hash64& state, uint64_t seed)
+{
+    state = {};
+    state.seed = seed;
+    state.v[0] = seed + xXXH_P1 + xXXH_P2;
+    state.v[1] = seed + xXXH_P2;
+    state.v[2] = seed;
+    state.v[3] = seed - xXXH_P1;
+}
+
+void ev_Hash64Update(Ev_Hash64& state, const void* data, size_t len)
+{
+    auto* p   = (const uint8_t*)data;
+    auto* end = p + len;
+    state.total += len;
+
+    if (state.tailSize + len < 32) {
+        memcpy(state.tail + state.tailSize, p, len);
+        state.tailSize += uint32_t(len);
+        return;
+    }
+
+    if (state.tailSize) {
+        auto fill = 32 - state.tailSize;
+        memcpy(state.tail + state.tailSize, p, fill);
+        for (int lane=0; lane<4; ++lane) {
+            state.v[lane] = ev_XXHRound(state.v[lane], ev_Read64(state.tail + lane*8));
+        }
+        p += fill;
+        state.tailSize = 0;
+    }
+
+    // the hot loop: lanes are independent, so this runs at memory speed.
+    uint64_t v0 = state.v[0], v1 = state.v[1], v2 = state.v[2], v3 = state.v[3];
+    while (end - p >= 32) {
+        v0 = ev_XXHRound(v0, ev_Read64(p +  0));
+        v1 = ev_XXHRound(v1, ev_Read64(p +  8));
+        v2 = ev_XXHRound(v2, ev_Read64(p + 16));
+        v3 = ev_XXHRound(v3, ev_Read64(p + 24));
+        p += 32;
+    }
+    state.v[0] = v0;  state.v[1] = v1;  state.v[2] = v2;  state.v[3] = v3;
+
+    state.tailSize = uint32_t(end - p);
+    memcpy(state.tail, p, state.tailSize);
+}
+
+uint64_t ev_Hash64Final(const Ev_Hash64& state)
+{
+    uint64_t h;
+    if (state.total >= 32) {
+        h = _rotl64(state.v[0], 1) + _rotl64(state.v[1], 7) + _rotl64(state.v[2], 12) + _rotl64(state.v[3], 18);
+        for (int lane=0; lane<4; ++lane) {
+            h = ev_XXHMerge(h, state.v[lane]);
+        }
+    }
+    else {
+        h = state.seed + xXXH_P5;
+    }
+    h += state.total;
+
+    auto* p   = state.tail;
+    auto* end = state.tail + state.tailSize;
+    while (end - p >= 8) {
+        h ^= ev_XXHRound(0, ev_Read64(p));
+        h  = _rotl64(h, 27) * xXXH_P1 + xXXH_P4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= uint64_t(ev_Read32(p)) * xXXH_P1;
+        h  = _rotl64(h, 23) * xXXH_P2 + xXXH_P3;
+        p += 4;
     }
+    while (p < end) {
+        h ^= (*p) * xXXH_P5;
+        h  = _rotl64(h, 11) * xXXH_P1;
+        ++p;
+    }
+
+    h ^= h >> 33;  h *= xXXH_P2;
+    h ^= h >> 29;  h *= xXXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Hashes a file's contents through a sliding view of its mapping.  Returns false if the file
+// can't be read, in which case the caller folds a "missing" marker into the key instead.
+bool ev_HashFile(const std::wstring& path, uint64_t& size, uint64_t& hash)
+{
+    // 64MB views: large enough that mapping overhead vanishes, small enough for 32-bit builds.
+    static const uint64_t xViewSize = 64ull * 1024 * 1024;
+
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize = {};
+    GetFileSizeEx(hFile, &fileSize);
+    size = uint64_t(fileSize.QuadPart);
+
+    Ev_Hash64 state;
+    ev_Hash64Init(state, 0);
+
+    bool ok = true;
+    if (size) {
+        // CreateFileMapping refuses zero-length files, hence the guard.
+        HANDLE hMap = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        ok = (hMap != nullptr);
+        for (uint64_t offset = 0; ok && offset < size; offset += xViewSize) {
+            auto viewLen = size_t(((size - offset) < xViewSize) ? (size - offset) : xViewSize);
+            auto* view   = MapViewOfFile(hMap, FILE_MAP_READ, DWORD(offset >> 32), DWORD(offset), viewLen);
+            if (!view) {
+                ok = false;
+                break;
+            }
+            ev_Hash64Update(state, view, viewLen);
+            UnmapViewOfFile(view);
+        }
+        if (hMap) CloseHandle(hMap);
+    }
+    CloseHandle(hFile);
+
+    hash = ev_Hash64Final(state);
+    return ok;
+}
+
+std::wstring ev_MemoKey(const WCHAR* ApplicationName, const WCHAR* CommandLine, const Ev_ShellExecFlags& flags)
+{
+    // key material is small, so the final 128-bit key is simply two differently-seeded hashes of it.
+    std::vector<uint8_t> material;
+    auto put = [&](const void* src, size_t len) {
+        material.insert(material.end(), (const uint8_t*)src, (const uint8_t*)src + len);
+    };
+    auto putStr = [&](const std::wstring& str) {
+        put(str.c_str(), (str.length() + 1) * sizeof(WCHAR));
+    };
+
+    bool elevated = !flags.NoElevate;
+    putStr(L"eudo-memo-2");
+    putStr(ApplicationName);
+    putStr(CommandLine);
+    put(&elevated, sizeof(elevated));
+    putStr(ev_GetCurrentDir());
+
+    for (const auto& name : g_MemoEnvNames) {
+        std::wstring value;
+        bool defined = !ev_GetEnvironmentVariable(name.c_str(), value);
+        putStr(name);
+        put(&defined, sizeof(defined));
+        putStr(value);
+    }
+
+    for (const auto& input : g_MemoInputs) {
+        uint64_t size = 0;
+        uint64_t hash = 0;
+        auto start = ev_StatsNow();
+        bool present = ev_HashFile(input, size, hash);
+        putStr(input);
+        put(&present, sizeof(present));
+        put(&size, sizeof(size));
+        put(&hash, sizeof(hash));
+
+        if (g_Verbose) {
+            LARGE_INTEGER freq;
+            QueryPerformanceFrequency(&freq);
+            log_console(L"Memo input         = %s (%llu bytes, %016llx, %.2f ms)\n", input.c_str(), size, hash,
+                double(ev_StatsNow() - start) * 1000.0 / double(freq.QuadPart));
+        }
+    }
+
+    Ev_Hash64 lo, hi;
+    ev_Hash64Init(lo, 0);
+    ev_Hash64Init(hi, xXXH_P3);
+    ev_Hash64Update(lo, material.data(), material.size());
+    ev_Hash64Update(hi, material.data(), material.size());
+    return xStringFormat(L"%016llx%016llx", ev_Hash64Final(hi), ev_Hash64Final(lo));
+}
+
+std::wstring ev_MemoPath(const std::wstring& key)
+{
+    auto dir = ev_GetLocalDataDir();
+    if (dir.empty()) {
+        return {};
+    }
+    dir += L"\\memo";
+    CreateDirectory(dir.c_str(), nullptr);
+    return dir + L"\\" + key;
+}
+
+bool ev_MemoLookup(const std::wstring& key)
+{
+    auto path = ev_MemoPath(key);
+    return !path.empty() && PathFileExists(path.c_str());
+}
+
+void ev_MemoRecord(const std::wstring& key, const WCHAR* ApplicationName, const WCHAR* CommandLine)
+{
+    auto path = ev_MemoPath(key);
+    if (path.empty()) {
+        return;
+    }
+
+    // contents are informational only, for whoever goes looking in the memo directory.
+    auto text = ev_ToUtf8(xStringFormat(L"%s %s\r\n", ApplicationName, CommandLine));
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile != INVALID_HANDLE_VALUE) {
+        DWORD wrote;
+        WriteFile(hFile, text.data(), DWORD(text.size()), &wrote, nullptr);
+        CloseHandle(hFile);
+    }
+}
 
+int ShellExecPty(const WCHAR* ApplicationName, const WCHAR* CommandLine, const Ev_ShellExecFlags& flags);
+
+// Returns EXIT_FAILURE if the program could not be launched.  childExitCode receives the child's
+// exit code when waited for, or EXIT_SUCCESS under --nowait.
+int ShellExecRunas(const WCHAR* ApplicationName, const WCHAR* CommandLine, const Ev_ShellExecFlags& flags, int& childExitCode)
+{
     SHELLEXECUTEINFO Shex = {};
     Shex.cbSize         = sizeof( SHELLEXECUTEINFO );
     Shex.fMask          = SEE_MASK_NO_CONSOLE | SEE_MASK_FLAG_NO_UI | SEE_MASK_NOCLOSEPROCESS;
@@ -272,11 +818,12 @@ int ShellExec(const WCHAR* ApplicationName, const WCHAR* CommandLine, const Ev_S
 
     auto cwd = ev_GetCurrentDir();
 
-    Shex.lpVerb         = L"runas";
+    Shex.lpVerb         = flags.NoElevate ? nullptr : L"runas";
     Shex.lpFile         = ApplicationName;
     Shex.lpParameters   = CommandLine;
     Shex.nShow          = flags.HideWindow ? SW_HIDE : SW_SHOW;
 
+    auto elevateStart = ev_StatsNow();
     if (!ShellExecuteEx(&Shex))
     {
         HRESULT Err = HRESULT_FROM_WIN32(GetLastError());
@@ -292,17 +839,53 @@ int ShellExec(const WCHAR* ApplicationName, const WCHAR* CommandLine, const Ev_S
     }
 
     _ASSERTE(Shex.hProcess);
+    ev_StatsRecord(StatsPhase_Elevate, elevateStart);
 
+    DWORD procExitCode = EXIT_SUCCESS;
     if (!flags.DoNotWaitForProc)
     {
-        DWORD procExitCode;
+        auto childStart = ev_StatsNow();
         WaitForSingleObject(Shex.hProcess, INFINITE);
         GetExitCodeProcess (Shex.hProcess, &procExitCode);
+        ev_StatsRecord(StatsPhase_Child, childStart);
     }
     CloseHandle (Shex.hProcess);
+    childExitCode = int(procExitCode);
     return EXIT_SUCCESS;
 }
 
+int ShellExec(const WCHAR* ApplicationName, const WCHAR* CommandLine, const Ev_ShellExecFlags& flags)
+{
+    if (g_Verbose) {
+        log_console(L"ShellExec(\n  App  = %s\n  Args = %s\n)\n", ApplicationName, CommandLine);
+    }
+
+    std::wstring memoKey;
+    if (g_Memo) {
+        memoKey = ev_MemoKey(ApplicationName, CommandLine, flags);
+        if (g_Verbose) {
+            log_console(L"Memo key           = %s\n", memoKey.c_str());
+        }
+        if (ev_MemoLookup(memoKey)) {
+            if (g_Verbose) {
+                log_console(L"Memo hit, skipping elevation.\n");
+            }
+            return EXIT_SUCCESS;
+        }
+    }
+
+    // --pty has always propagated the child's exit code, since the host is the only one to see it.
+    int childExitCode = EXIT_SUCCESS;
+    int result = flags.PseudoConsole
+        ? (childExitCode = ShellExecPty(ApplicationName, CommandLine, flags))
+        : ShellExecRunas(ApplicationName, CommandLine, flags, childExitCode);
+
+    if (g_Memo && result == EXIT_SUCCESS && childExitCode == EXIT_SUCCESS && !flags.DoNotWaitForProc) {
+        ev_MemoRecord(memoKey, ApplicationName, CommandLine);
+    }
+    return result;
+}
+
 std::wstring xStringJoin(const WCHAR* joiner, const ArgContainer& container)
 {
     std::wstring result;
@@ -354,218 +937,2648 @@ std::wstring FindBestExt(const std::wstring& appName)
                 thisExt.clear();
             }
 
-            if (!curch) { return {}; }
+            if (!curch) { return {}; }
+        }
+        else {
+            thisExt += curch;
+        }
+    }
+}
+
+std::wstring escape_quotes(const WCHAR* src)
+{
+    if (!src) return {};
+
+    bool hasSpace = 0;
+    std::wstring result;
+    while(src[0]) {
+        if (src[0] == L'"') {
+            result += L"\\";
+        }
+        hasSpace = hasSpace || (src[0] == L' ') || (src[0] == L'\t') || (src[0] == L'\r') || (src[0] == L'\n');
+        result += src[0];
+        ++src;
+    }
+
+    // only add double quotes if whitespace detected.
+    // Ensures we get as much out of the max-allowed xMaxEnviron length as possible.
+
+    if (hasSpace) {
+        return L"\"" + result + L"\"";
+    }
+    else {
+        return result;
+    }
+}
+
+// --pty support
+//
+// An elevated process cannot be attached to the console of a non-elevated one, and ShellExecuteEx
+// gives us no say in how the elevated process is created.  So the work is split in two:
+//
+//   * the caller (non-elevated) creates three named pipes and elevates a second copy of eudo in
+//     `--pty-host` mode, with its window hidden.
+//   * the host (elevated) hands the in/out pipes directly to a ConPTY pseudo console and creates
+//     the target process attached to it.  The host never touches the data stream itself, so the
+//     only relay hop is the caller copying between its own console and the pipes.
+//
+// The third pipe is a small control channel: the caller sends the command line, cwd and initial
+// console size, and after that any window resize events.  The child's exit code is propagated as
+// the host's exit code, which the caller retrieves from the process handle ShellExecuteEx gives us.
+//
+// Security: the elevated child is driven by the caller's console, which runs at the caller's
+// (medium) integrity level.  Any other non-elevated process of the same user can attach to that
+// console and read its output or inject keystrokes into the elevated program.  This is the same
+// trade-off as sudo's inline mode on Windows, and is why --pty is opt-in.
+
+// ConPTY is Windows 10 1809+ and this program targets Vista, so the API is resolved at runtime
+// rather than linked.  The SDK only declares these when NTDDI_VERSION is new enough, hence our own
+// typedefs.
+typedef VOID* Ev_HPCON;
+using CreatePseudoConsole_t = HRESULT (WINAPI*)(COORD size, HANDLE hInput, HANDLE hOutput, DWORD dwFlags, Ev_HPCON* phPC);
+using ResizePseudoConsole_t = HRESULT (WINAPI*)(Ev_HPCON hPC, COORD size);
+using ClosePseudoConsole_t  = VOID    (WINAPI*)(Ev_HPCON hPC);
+
+static const DWORD_PTR xProcThreadAttributePseudoConsole = 0x00020016;
+
+#if !defined(ENABLE_VIRTUAL_TERMINAL_INPUT)
+#   define ENABLE_VIRTUAL_TERMINAL_INPUT        0x0200
+#endif
+#if !defined(ENABLE_VIRTUAL_TERMINAL_PROCESSING)
+#   define ENABLE_VIRTUAL_TERMINAL_PROCESSING   0x0004
+#endif
+#if !defined(DISABLE_NEWLINE_AUTO_RETURN)
+#   define DISABLE_NEWLINE_AUTO_RETURN          0x0008
+#endif
+
+struct Ev_ConPtyApi {
+    CreatePseudoConsole_t   Create;
+    ResizePseudoConsole_t   Resize;
+    ClosePseudoConsole_t    Close;
+};
+
+bool ev_LoadConPtyApi(Ev_ConPtyApi& api)
+{
+    auto kernel = GetModuleHandle(L"kernel32.dll");
+    api.Create  = (CreatePseudoConsole_t)GetProcAddress(kernel, "CreatePseudoConsole");
+    api.Resize  = (ResizePseudoConsole_t)GetProcAddress(kernel, "ResizePseudoConsole");
+    api.Close   = (ClosePseudoConsole_t )GetProcAddress(kernel, "ClosePseudoConsole" );
+    return api.Create && api.Resize && api.Close;
+}
+
+enum Ev_PtyMsgType : uint32_t {
+    PtyMsg_Launch   = 1,    // payload: command line \0 cwd \0 (UTF-16)
+    PtyMsg_Resize   = 2,    // no payload
+};
+
+struct Ev_PtyMsgHeader {
+    uint32_t    type;
+    uint32_t    length;     // payload length in bytes, following the header
+    int16_t     cols;
+    int16_t     rows;
+};
+
+std::wstring ev_PtyPipeName(const WCHAR* pipeId, const WCHAR* suffix)
+{
+    return xStringFormat(L"\\\\.\\pipe\\eudo-pty-%s-%s", pipeId, suffix);
+}
+
+COORD ev_GetConsoleSize(HANDLE hConsole)
+{
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(hConsole, &info)) {
+        return { 80, 25 };
+    }
+    return {
+        SHORT(info.srWindow.Right  - info.srWindow.Left + 1),
+        SHORT(info.srWindow.Bottom - info.srWindow.Top  + 1)
+    };
+}
+
+// The caller side of the pipes is overlapped so that connecting can be abandoned if the host dies
+// (or the user declines the UAC prompt after ShellExecuteEx has already returned).  Each pipe has
+// exactly one thread doing I/O on it, so one event per pipe is sufficient.
+bool ev_OverlappedIo(HANDLE pipe, HANDLE evt, bool isWrite, void* buf, DWORD len, DWORD& xfer)
+{
+    OVERLAPPED ov = {};
+    ov.hEvent = evt;
+    xfer = 0;
+
+    BOOL ok = isWrite
+        ? WriteFile(pipe, buf, len, nullptr, &ov)
+        : ReadFile (pipe, buf, len, nullptr, &ov);
+
+    if (!ok && GetLastError() != ERROR_IO_PENDING) {
+        return false;
+    }
+    return GetOverlappedResult(pipe, &ov, &xfer, TRUE) != FALSE;
+}
+
+bool ev_OverlappedWriteAll(HANDLE pipe, HANDLE evt, const void* buf, DWORD len)
+{
+    auto* src = (const uint8_t*)buf;
+    while (len) {
+        DWORD xfer;
+        if (!ev_OverlappedIo(pipe, evt, true, (void*)src, len, xfer) || !xfer) {
+            return false;
+        }
+        src += xfer;
+        len -= xfer;
+    }
+    return true;
+}
+
+bool ev_ReadExact(HANDLE handle, void* buf, DWORD len)
+{
+    auto* dest = (uint8_t*)buf;
+    while (len) {
+        DWORD xfer = 0;
+        if (!ReadFile(handle, dest, len, &xfer, nullptr) || !xfer) {
+            return false;
+        }
+        dest += xfer;
+        len  -= xfer;
+    }
+    return true;
+}
+
+HANDLE ev_CreateSingleInstancePipe(const std::wstring& name, DWORD direction)
+{
+    // Single instance and FIRST_PIPE_INSTANCE: if anything else already owns this name then we
+    // refuse to use it, rather than risk talking to a squatter.  Connecting clients still need to
+    // be checked, see ev_ConnectPipe().
+    return CreateNamedPipe(name.c_str(),
+        direction | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        1, 64 * 1024, 64 * 1024, 0, nullptr
+    );
+}
+
+// Waits for hostProcess to connect.  Whoever connects first wins a single-instance pipe, and our
+// pipe names are predictable, so the client is checked to really be hostProcess: anything else of
+// the same user could otherwise race it and read or inject the data meant for it.
+bool ev_ConnectPipe(HANDLE pipe, HANDLE hostProcess)
+{
+    OVERLAPPED ov = {};
+    ov.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    bool connected = ConnectNamedPipe(pipe, &ov) != FALSE;
+    if (!connected) {
+        DWORD unused;
+        auto err = GetLastError();
+        if (err == ERROR_PIPE_CONNECTED) {
+            connected = true;
+        }
+        else if (err == ERROR_IO_PENDING) {
+            HANDLE waits[2] = { ov.hEvent, hostProcess };
+            if (WaitForMultipleObjects(2, waits, FALSE, INFINITE) == WAIT_OBJECT_0) {
+                connected = GetOverlappedResult(pipe, &ov, &unused, FALSE) != FALSE;
+            }
+            else {
+                CancelIo(pipe);
+                GetOverlappedResult(pipe, &ov, &unused, TRUE);
+            }
+        }
+    }
+    CloseHandle(ov.hEvent);
+
+    ULONG clientPid = 0;
+    if (connected && (!GetNamedPipeClientProcessId(pipe, &clientPid) || clientPid != GetProcessId(hostProcess))) {
+        log_error(L"ERROR- unexpected process %u connected to a private pipe; refusing to use it.\n", clientPid);
+        DisconnectNamedPipe(pipe);
+        connected = false;
+    }
+    return connected;
+}
+
+struct Ev_PtyRelayContext {
+    HANDLE      hStdIn;
+    HANDLE      hStdOut;
+    bool        inIsConsole;
+    HANDLE      pipeIn;
+    HANDLE      pipeCtl;
+    HANDLE      evtIn;
+    HANDLE      evtCtl;
+};
+
+bool ev_PtySendResize(const Ev_PtyRelayContext& ctx)
+{
+    auto size = ev_GetConsoleSize(ctx.hStdOut);
+    Ev_PtyMsgHeader msg = { PtyMsg_Resize, 0, size.X, size.Y };
+    return ev_OverlappedWriteAll(ctx.pipeCtl, ctx.evtCtl, &msg, sizeof(msg));
+}
+
+bool ev_PtySendKeys(const Ev_PtyRelayContext& ctx, const std::wstring& keys)
+{
+    if (keys.empty()) return true;
+
+    // ConPTY expects UTF-8 on its input pipe.  A batch can be arbitrarily large (pastes, repeat
+    // counts), so size the buffer to fit rather than truncating.
+    auto len = WideCharToMultiByte(CP_UTF8, 0, keys.data(), int(keys.length()), nullptr, 0, nullptr, nullptr);
+    if (len <= 0) {
+        return false;
+    }
+    std::string utf8;
+    utf8.resize(len);
+    WideCharToMultiByte(CP_UTF8, 0, keys.data(), int(keys.length()), utf8.data(), len, nullptr, nullptr);
+    return ev_OverlappedWriteAll(ctx.pipeIn, ctx.evtIn, utf8.data(), DWORD(len));
+}
+
+DWORD WINAPI PtyInputRelayThread(void* param)
+{
+    const auto& ctx = *(const Ev_PtyRelayContext*)param;
+
+    if (!ctx.inIsConsole) {
+        // redirected stdin (ssh, scripts): plain byte copy, and there's no such thing as a resize.
+        char buf[4096];
+        DWORD got;
+        while (ReadFile(ctx.hStdIn, buf, sizeof(buf), &got, nullptr) && got) {
+            if (!ev_OverlappedWriteAll(ctx.pipeIn, ctx.evtIn, buf, got)) break;
+        }
+        return 0;
+    }
+
+    // Console input is read as records rather than bytes so that WINDOW_BUFFER_SIZE_EVENT arrives
+    // in-band with keystrokes.  With ENABLE_VIRTUAL_TERMINAL_INPUT the console already translates
+    // special keys into VT sequences for us, so only the UnicodeChar of each key-down matters.
+    // Keys are forwarded per batch read rather than per record, to keep pipe writes to a minimum
+    // without adding any delay.
+
+    INPUT_RECORD records[128];
+    std::wstring keys;
+    while (1) {
+        DWORD numRead = 0;
+        if (!ReadConsoleInputW(ctx.hStdIn, records, _countof(records), &numRead)) break;
+
+        keys.clear();
+        for (DWORD n=0; n<numRead; ++n) {
+            const auto& rec = records[n];
+            if (rec.EventType == KEY_EVENT) {
+                const auto& key = rec.Event.KeyEvent;
+                if (key.bKeyDown && key.uChar.UnicodeChar) {
+                    keys.append(key.wRepeatCount ? key.wRepeatCount : 1, key.uChar.UnicodeChar);
+                }
+            }
+            else if (rec.EventType == WINDOW_BUFFER_SIZE_EVENT) {
+                if (!ev_PtySendKeys(ctx, keys)) return 0;
+                keys.clear();
+                if (!ev_PtySendResize(ctx)) return 0;
+            }
+        }
+        if (!ev_PtySendKeys(ctx, keys)) break;
+    }
+    return 0;
+}
+
+int ShellExecPty(const WCHAR* ApplicationName, const WCHAR* CommandLine, const Ev_ShellExecFlags& flags)
+{
+    Ev_ConPtyApi api;
+    if (!ev_LoadConPtyApi(api)) {
+        log_error(L"ERROR- --pty requires Windows 10 version 1809 or newer (ConPTY).\n");
+        return EXIT_FAILURE;
+    }
+
+    auto pipeId = xStringFormat(L"%u-%u", GetCurrentProcessId(), GetTickCount());
+
+    HANDLE pipeIn  = ev_CreateSingleInstancePipe(ev_PtyPipeName(pipeId.c_str(), L"in" ), PIPE_ACCESS_OUTBOUND);
+    HANDLE pipeOut = ev_CreateSingleInstancePipe(ev_PtyPipeName(pipeId.c_str(), L"out"), PIPE_ACCESS_INBOUND );
+    HANDLE pipeCtl = ev_CreateSingleInstancePipe(ev_PtyPipeName(pipeId.c_str(), L"ctl"), PIPE_ACCESS_OUTBOUND);
+
+    if (pipeIn == INVALID_HANDLE_VALUE || pipeOut == INVALID_HANDLE_VALUE || pipeCtl == INVALID_HANDLE_VALUE) {
+        HRESULT Err = HRESULT_FROM_WIN32(GetLastError());
+        log_error(L"ERROR- failed to create pseudo console pipes.\nWindows Error 0x%08x - %s\n", Err, HRESULT_to_string(Err).c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto selfPath = ev_GetModuleFileName();
+    auto hostArgs = xStringFormat(L"--pty-host=%s", pipeId.c_str());
+
+    SHELLEXECUTEINFO Shex = {};
+    Shex.cbSize         = sizeof( SHELLEXECUTEINFO );
+    Shex.fMask          = SEE_MASK_NO_CONSOLE | SEE_MASK_FLAG_NO_UI | SEE_MASK_NOCLOSEPROCESS;
+    Shex.lpVerb         = flags.NoElevate ? nullptr : L"runas";
+    Shex.lpFile         = selfPath.c_str();
+    Shex.lpParameters   = hostArgs.c_str();
+    Shex.nShow          = SW_HIDE;
+
+    auto elevateStart = ev_StatsNow();
+    if (!ShellExecuteEx(&Shex))
+    {
+        HRESULT Err = HRESULT_FROM_WIN32(GetLastError());
+        log_error(L"%s could not be launched\nWindows Error 0x%08x - %s \n", ApplicationName, Err, HRESULT_to_string(Err).c_str());
+        return EXIT_FAILURE;
+    }
+
+    _ASSERTE(Shex.hProcess);
+
+    // connection order must match the order the host opens them in.
+    if (!ev_ConnectPipe(pipeCtl, Shex.hProcess) ||
+        !ev_ConnectPipe(pipeIn,  Shex.hProcess) ||
+        !ev_ConnectPipe(pipeOut, Shex.hProcess)) {
+        log_error(L"ERROR- elevated pseudo console host exited before connecting.\n");
+        CloseHandle(Shex.hProcess);
+        return EXIT_FAILURE;
+    }
+
+    // for --pty, elevation is considered complete once the host is connected.
+    ev_StatsRecord(StatsPhase_Elevate, elevateStart);
+    auto childStart = ev_StatsNow();
+
+    Ev_PtyRelayContext ctx = {};
+    ctx.hStdIn      = GetStdHandle(STD_INPUT_HANDLE);
+    ctx.hStdOut     = GetStdHandle(STD_OUTPUT_HANDLE);
+    ctx.pipeIn      = pipeIn;
+    ctx.pipeCtl     = pipeCtl;
+    ctx.evtIn       = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    ctx.evtCtl      = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    DWORD inModeOrig  = 0;
+    DWORD outModeOrig = 0;
+    ctx.inIsConsole   = GetConsoleMode(ctx.hStdIn,  &inModeOrig ) != FALSE;
+    bool outIsConsole = GetConsoleMode(ctx.hStdOut, &outModeOrig) != FALSE;
+
+    // raw mode: no line buffering, no local echo, and CTRL+C is passed through as ^C so that it
+    // reaches the elevated child rather than killing the relay.
+    if (ctx.inIsConsole) {
+        SetConsoleMode(ctx.hStdIn, ENABLE_VIRTUAL_TERMINAL_INPUT | ENABLE_WINDOW_INPUT);
+    }
+    // ConPTY output is always UTF-8, and is written to the console as raw bytes.
+    UINT outCodePageOrig = 0;
+    if (outIsConsole) {
+        SetConsoleMode(ctx.hStdOut, outModeOrig | ENABLE_VIRTUAL_TERMINAL_PROCESSING | DISABLE_NEWLINE_AUTO_RETURN);
+        outCodePageOrig = GetConsoleOutputCP();
+        SetConsoleOutputCP(CP_UTF8);
+    }
+
+    if (1) {
+        auto cmdline = escape_quotes(ApplicationName) + L" " + CommandLine;
+        auto cwd     = ev_GetCurrentDir();
+        auto size    = ev_GetConsoleSize(ctx.hStdOut);
+
+        std::wstring payload;
+        payload += cmdline;  payload += L'\0';
+        payload += cwd;      payload += L'\0';
+
+        Ev_PtyMsgHeader msg = { PtyMsg_Launch, DWORD(payload.length() * sizeof(WCHAR)), size.X, size.Y };
+        ev_OverlappedWriteAll(pipeCtl, ctx.evtCtl, &msg, sizeof(msg));
+        ev_OverlappedWriteAll(pipeCtl, ctx.evtCtl, payload.data(), msg.length);
+    }
+
+    // input relay runs on its own thread since it blocks on the console; output is relayed here
+    // until the host closes the pseudo console, which breaks the pipe.
+    HANDLE hInputThread = CreateThread(nullptr, 0, PtyInputRelayThread, &ctx, 0, nullptr);
+
+    HANDLE evtOut = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    char buf[16384];
+    while (1) {
+        DWORD got, wrote;
+        if (!ev_OverlappedIo(pipeOut, evtOut, false, buf, sizeof(buf), got) || !got) break;
+        if (!WriteFile(ctx.hStdOut, buf, got, &wrote, nullptr)) break;
+    }
+
+    DWORD procExitCode = EXIT_FAILURE;
+    WaitForSingleObject(Shex.hProcess, INFINITE);
+    GetExitCodeProcess (Shex.hProcess, &procExitCode);
+    CloseHandle        (Shex.hProcess);
+    ev_StatsRecord(StatsPhase_Child, childStart);
+
+    if (ctx.inIsConsole) SetConsoleMode(ctx.hStdIn,  inModeOrig );
+    if (outIsConsole)    SetConsoleMode(ctx.hStdOut, outModeOrig);
+    if (outCodePageOrig) SetConsoleOutputCP(outCodePageOrig);
+
+    // the input thread is likely still blocked reading the console, and there's no clean way
+    // to wake it.  It's harmless: the process is about to exit anyway.
+    if (hInputThread) CloseHandle(hInputThread);
+    CloseHandle(evtOut);
+    CloseHandle(pipeOut);
+    return int(procExitCode);
+}
+
+struct Ev_PtyHostContext {
+    Ev_ConPtyApi    api;
+    Ev_HPCON        hpc;
+    HANDLE          pipeCtl;
+};
+
+DWORD WINAPI PtyHostControlThread(void* param)
+{
+    const auto& ctx = *(const Ev_PtyHostContext*)param;
+
+    Ev_PtyMsgHeader msg;
+    while (ev_ReadExact(ctx.pipeCtl, &msg, sizeof(msg))) {
+        if (msg.type == PtyMsg_Resize) {
+            ctx.api.Resize(ctx.hpc, { msg.cols, msg.rows });
+        }
+        else {
+            // no other messages are expected after launch.  Skip the payload and carry on.
+            std::vector<uint8_t> skip(msg.length);
+            if (msg.length && !ev_ReadExact(ctx.pipeCtl, skip.data(), msg.length)) break;
+        }
+    }
+    return 0;
+}
+
+int PtyHostMain(const WCHAR* pipeId)
+{
+    // Runs elevated, in a hidden console.  Nobody is going to see anything logged from here except
+    // a debugger, so errors just translate into EXIT_FAILURE for the caller.
+
+    Ev_PtyHostContext ctx = {};
+    if (!ev_LoadConPtyApi(ctx.api)) {
+        return EXIT_FAILURE;
+    }
+
+    ctx.pipeCtl     = CreateFile(ev_PtyPipeName(pipeId, L"ctl").c_str(), GENERIC_READ,  0, nullptr, OPEN_EXISTING, 0, nullptr);
+    HANDLE pipeIn   = CreateFile(ev_PtyPipeName(pipeId, L"in" ).c_str(), GENERIC_READ,  0, nullptr, OPEN_EXISTING, 0, nullptr);
+    HANDLE pipeOut  = CreateFile(ev_PtyPipeName(pipeId, L"out").c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+
+    if (ctx.pipeCtl == INVALID_HANDLE_VALUE || pipeIn == INVALID_HANDLE_VALUE || pipeOut == INVALID_HANDLE_VALUE) {
+        log_error(L"ERROR- pty host failed to open pipes for id %s\n", pipeId);
+        return EXIT_FAILURE;
+    }
+
+    Ev_PtyMsgHeader msg;
+    if (!ev_ReadExact(ctx.pipeCtl, &msg, sizeof(msg)) || msg.type != PtyMsg_Launch || (msg.length % sizeof(WCHAR))) {
+        return EXIT_FAILURE;
+    }
+
+    std::wstring payload;
+    payload.resize(msg.length / sizeof(WCHAR));
+    if (msg.length && !ev_ReadExact(ctx.pipeCtl, payload.data(), msg.length)) {
+        return EXIT_FAILURE;
+    }
+
+    auto sep = payload.find(L'\0');
+    if (sep == std::wstring::npos) {
+        return EXIT_FAILURE;
+    }
+    std::wstring cmdline = payload.substr(0, sep);
+    std::wstring cwd     = payload.c_str() + sep + 1;
+
+    if (FAILED(ctx.api.Create({ msg.cols, msg.rows }, pipeIn, pipeOut, 0, &ctx.hpc))) {
+        return EXIT_FAILURE;
+    }
+
+    // ConPTY duplicates the pipe handles; ours must be closed or the caller never sees the
+    // broken pipe that signals the end of output.
+    CloseHandle(pipeIn);
+    CloseHandle(pipeOut);
+
+    SIZE_T attrSize = 0;
+    InitializeProcThreadAttributeList(nullptr, 1, 0, &attrSize);
+    std::vector<uint8_t> attrBuf(attrSize);
+    auto* attrs = (LPPROC_THREAD_ATTRIBUTE_LIST)attrBuf.data();
+    InitializeProcThreadAttributeList(attrs, 1, 0, &attrSize);
+    UpdateProcThreadAttribute(attrs, 0, xProcThreadAttributePseudoConsole, ctx.hpc, sizeof(ctx.hpc), nullptr, nullptr);
+
+    STARTUPINFOEXW si = {};
+    si.StartupInfo.cb   = sizeof(si);
+    si.lpAttributeList  = attrs;
+
+    // The cwd is given to CreateProcess directly, so unlike ExecComspec there's no need for the
+    // `cd /d` dance here -- though it's harmless when the command line came from ExecComspec.
+    PROCESS_INFORMATION pi = {};
+    if (!CreateProcessW(nullptr, cmdline.data(), nullptr, nullptr, FALSE, EXTENDED_STARTUPINFO_PRESENT,
+            nullptr, cwd.empty() ? nullptr : cwd.c_str(), &si.StartupInfo, &pi)) {
+        ctx.api.Close(ctx.hpc);
+        DeleteProcThreadAttributeList(attrs);
+        return EXIT_FAILURE;
+    }
+
+    HANDLE hCtlThread = CreateThread(nullptr, 0, PtyHostControlThread, &ctx, 0, nullptr);
+
+    DWORD procExitCode = EXIT_FAILURE;
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    GetExitCodeProcess (pi.hProcess, &procExitCode);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+
+    // ClosePseudoConsole flushes remaining output and closes the out pipe, which is what
+    // terminates the caller's relay loop.
+    ctx.api.Close(ctx.hpc);
+    DeleteProcThreadAttributeList(attrs);
+
+    if (hCtlThread) CloseHandle(hCtlThread);
+    return int(procExitCode);
+}
+
+int ExecComspec(const ArgContainer& cmdargs, const Ev_ShellExecFlags& flags_in)
+{
+    std::wstring environVarBuffer;
+    std::wstring CmdLineBuffer;
+
+    Ev_ShellExecFlags flags = flags_in;
+    if (flags.HideWindow && flags.ComspecRemains) {
+        log_error(L"WARN- refusing to hide an interactive COMSPEC since it leads to\n");
+        log_error(L"  an orphaned process.\n");
+        flags.HideWindow = 0;
+    }
+
+    if (HRESULT hr = ev_GetEnvironmentVariable( L"COMSPEC", environVarBuffer)) {
+        log_error(L"ERROR- %%COMSPEC%% environment variable is undefined or empty.\n");
+        log_error(L"  %%COMSPEC%% must be defined when specifying switches -c|-k\n");
+        _exit(EXIT_FAILURE);
+    }
+
+    // As of Windows 8, there's a security restriction that prevents cmd.exe from running inside
+    // the CWD when elevated to administrator.  This is no doubt some hurried cheap workaround
+    // for some silly user-opt-in security problem that is more correctly solved by telling
+    // users to stop downloading and running untrusted software.  But since this is Microsoft's
+    // world, we all have to pay the piper for the idiocy of the lowest common denominator.
+    //
+    // The workaround is instead of running the command directly, to do this:
+    //    cd /d %CWD%  && [actual-command]
+    //
+    // (if you're wondering how the Win8 policy change is supposed to protect anything when the
+    //  workaround is really that easy, then please join the club and scratch your head).
+    //
+    // But there is one small caveat:
+    //
+    //   $ cmd /C cd /d c:\mydir && echo success
+    //
+    // ... somehow executes cmd /C cd /d c:\mydir, and then runs `echo success` after the CMD is closed.
+    //     This happens from both the cmd prompt and from ShellExecuteEx().  But there's a workaround:
+    //
+    //   $ cmd /C " cd /d c:\mydir && echo success
+    //
+    // Yup, just add that quote.  CMD has some twisted bizarre way of handling quotes and nested quotes.
+    // while parsing /C and /K:  As far as I can tell, a double-quote at the start of the command will
+    // direct cmd.exe to interpret the rest of the command line as a single command -- no need to escape
+    // nested quotes or even provide the closing quote.  So that's what we do!
+
+    //                                  \/  and there's our mystery quote that makes it all work.
+    CmdLineBuffer = xStringFormat(L"/%c \" cd /d \"%s\" %s %s",
+        flags.ComspecRemains ? L'K' : L'C',
+        ev_GetCurrentDir().c_str(),
+        cmdargs.size() ? L"&&" : L"",
+        xStringJoin(L" ", cmdargs).c_str()
+    );
+    return ShellExec(environVarBuffer.c_str(), CmdLineBuffer.c_str(), flags);
+}
+
+// expands %1, %L, %* and friends in an association command string, the way CMD would.
+std::wstring ev_ExpandAssocCommand(const std::wstring& strCmd, const std::wstring& exe_fullname, const ArgContainer& cmdargs)
+{
+    std::wstring CmdLineBuffer;
+    if (1) {
+        int i = 0;
+        while(i < strCmd.length()) {
+            auto curch = (i < strCmd.length()) ? strCmd[i] : L'\0';
+            i += 1;
+            if (!curch) break;
+
+            if (curch == L'%') {
+                auto nextch = (i < strCmd.length()) ? strCmd[i] : L'\0';
+                i += 1;
+
+                switch(nextch)
+                {
+                    case L'%':
+                        CmdLineBuffer += L'%';
+                    break;
+
+                    case L'L':
+                    case L'l':
+                    case L'1':
+                        CmdLineBuffer += exe_fullname;
+                    break;
+
+                    case L'*':
+                        CmdLineBuffer += xStringJoin(L" ", cmdargs);
+                    break;
+
+                    case L'2': if (cmdargs.size() > 1) CmdLineBuffer += cmdargs[1]; break;
+                    case L'3': if (cmdargs.size() > 2) CmdLineBuffer += cmdargs[2]; break;
+                    case L'4': if (cmdargs.size() > 3) CmdLineBuffer += cmdargs[3]; break;
+                    case L'5': if (cmdargs.size() > 4) CmdLineBuffer += cmdargs[4]; break;
+                    case L'6': if (cmdargs.size() > 5) CmdLineBuffer += cmdargs[5]; break;
+                    case L'7': if (cmdargs.size() > 6) CmdLineBuffer += cmdargs[6]; break;
+                    case L'8': if (cmdargs.size() > 7) CmdLineBuffer += cmdargs[7]; break;
+                    case L'9': if (cmdargs.size() > 8) CmdLineBuffer += cmdargs[8]; break;
+
+                    default:
+                        // mimic windows CMD.exe behavior, which is to just output the % unmodified if the command isn't supported.
+                        CmdLineBuffer += L'%';
+                        CmdLineBuffer += curch;
+                    break;
+                }
+            }
+            else {
+                CmdLineBuffer += curch;
+            }
+        }
+    }
+    return CmdLineBuffer;
+}
+
+std::wstring ev_LookupAssocCommand(const std::wstring& extension)
+{
+    return ev_AssocQueryString(ASSOCSTR_COMMAND, extension.c_str());
+}
+
+// Warm interpreter pool (--pool-start)
+//
+// For script targets most of the cost after elevation is the interpreter's own startup.  The pool
+// is an elevated eudo server (one UAC prompt, at --pool-start) which keeps K idle interpreter
+// instances per configured extension, each already running a tiny bootstrap that blocks reading
+// its stdin.  A later eudo run for that extension connects to the server instead of elevating;
+// the server writes cwd/args/environment/script into an idle instance's stdin, relays its
+// stdout/stderr back, returns its exit code, and starts a replacement in the background.
+//
+// Security: while the pool is alive it is a same-user UAC bypass, in the style of `sudo`'s
+// timestamp -- any process that can reach the pipe and present the secret gets elevated execution
+// without a prompt.  The secret is handed out via EUDO_POOL, so every child of the shell that set
+// it inherits it, and any other non-elevated process of the same user can read it out of that
+// shell's environment.  What the pool does guarantee:
+//
+//   * the secret never appears on a command line: the server receives it over a single-instance
+//     pipe created by --pool-start, which only hands it over after checking that the connected
+//     client is the process it just elevated.
+//   * the pipe DACL lets the user read and write, but not create instances (that right is
+//     reserved to elevated Administrators), so nothing non-elevated can serve requests under the
+//     pool's name.  Remote clients are rejected.
+//   * clients check that the pipe is served by the pid named in EUDO_POOL, and that the process
+//     is elevated, before sending the secret.
+//
+// The server exits after an idle timeout.  Users who consider that trade-off unacceptable simply
+// don't start a pool.
+//
+// Limitations: pooled scripts have no stdin (it carries the request and is then at EOF), and
+// output is relayed through pipes rather than a console.  Only python, bash and PowerShell
+// handlers have a bootstrap; anything else is run the normal way.
+
+enum Ev_PoolKind {
+    PoolKind_None,
+    PoolKind_Python,
+    PoolKind_Bash,
+    PoolKind_PowerShell,
+};
+
+enum Ev_PoolMsgType : uint32_t {
+    PoolMsg_Run     = 1,    // client->server: secret, ext, script, cwd, numArgs, args..., env...
+    PoolMsg_Stop    = 2,    // client->server: secret
+    PoolMsg_Stdout  = 3,    // server->client: raw bytes
+    PoolMsg_Stderr  = 4,    // server->client: raw bytes
+    PoolMsg_Exit    = 5,    // server->client: int32 exit code
+    PoolMsg_Decline = 6,    // server->client: not handled, run it the normal way
+};
+
+struct Ev_PoolMsgHeader {
+    uint32_t    type;
+    uint32_t    length;
+};
+
+struct Ev_PoolInstance {
+    HANDLE      hProcess;
+    HANDLE      hStdIn;         // our write end
+    HANDLE      hStdOut;        // our read end
+    HANDLE      hStdErr;        // our read end
+};
+
+struct Ev_PoolHandler {
+    std::wstring                    extension;
+    Ev_PoolKind                     kind;
+    std::wstring                    interpreter;
+    int                             target;     // number of idle instances to keep
+    std::vector<Ev_PoolInstance>    idle;
+};
+
+static const int        xPoolSecretBytes    = 16;
+static const int        xPoolDefaultIdleSec = 600;
+static const int        xPoolDefaultMemMB   = 512;
+
+static CRITICAL_SECTION             g_PoolLock;
+static std::vector<Ev_PoolHandler>  g_PoolHandlers;
+static std::wstring                 g_PoolSecret;
+static HANDLE                       g_PoolWake          = nullptr;
+static volatile LONG                g_PoolActive        = 0;
+static volatile LONG                g_PoolStopping      = 0;
+static volatile LONG64              g_PoolLastRequest   = 0;
+static uint64_t                     g_PoolMemCap        = 0;
+
+std::wstring ev_PoolPipeName(const std::wstring& poolId)
+{
+    return L"\\\\.\\pipe\\eudo-pool-" + poolId;
+}
+
+// one-shot pipe over which --pool-start hands the secret to the server it just elevated.
+std::wstring ev_PoolInitPipeName(const std::wstring& poolId)
+{
+    return ev_PoolPipeName(poolId) + L"-init";
+}
+
+std::wstring ev_PackStrings(const ArgContainer& fields)
+{
+    std::wstring result;
+    for (const auto& field : fields) {
+        result += field;
+        result += L'\0';
+    }
+    return result;
+}
+
+ArgContainer ev_UnpackStrings(const std::wstring& packed)
+{
+    ArgContainer result;
+    size_t pos = 0;
+    while (pos < packed.length()) {
+        auto end = packed.find(L'\0', pos);
+        if (end == std::wstring::npos) end = packed.length();
+        result.push_back(packed.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return result;
+}
+
+Ev_PoolKind ev_PoolDetectKind(std::wstring& interpreter)
+{
+    auto* name = PathFindFileName(interpreter.c_str());
+
+    if (_wcsnicmp(name, L"python", 6) == 0 || _wcsicmp(name, L"py.exe") == 0) {
+        return PoolKind_Python;
+    }
+    if (_wcsicmp(name, L"powershell.exe") == 0 || _wcsicmp(name, L"pwsh.exe") == 0) {
+        return PoolKind_PowerShell;
+    }
+    if (_wcsicmp(name, L"bash.exe") == 0 || _wcsicmp(name, L"sh.exe") == 0) {
+        return PoolKind_Bash;
+    }
+    if (_wcsicmp(name, L"git-bash.exe") == 0) {
+        // git-bash.exe is a mintty launcher, not a shell.  The real thing lives next to it.
+        auto dir = interpreter.substr(0, name - interpreter.c_str());
+        for (auto* sub : { L"bin\\bash.exe", L"usr\\bin\\bash.exe" }) {
+            if (PathFileExists((dir + sub).c_str())) {
+                interpreter = dir + sub;
+                return PoolKind_Bash;
+            }
+        }
+    }
+    return PoolKind_None;
+}
+
+// The bootstrap is what each idle instance runs while it waits.  It must do nothing but read the
+// request from stdin (until EOF) and then become the script.
+std::wstring ev_PoolBootstrapCommandLine(const Ev_PoolHandler& handler)
+{
+    auto exe = escape_quotes(handler.interpreter.c_str());
+
+    switch (handler.kind) {
+        case PoolKind_Python:
+            // request: cwd \0 numArgs \0 script \0 args... \0 env... \0
+            return exe + L" -c \""
+                L"import sys,os,runpy;"
+                L"d=sys.stdin.buffer.read().decode('utf-8').split('\\0');"
+                L"os.chdir(d[0]);n=int(d[1]);sys.argv=d[2:3+n];"
+                L"e=[x.split('=',1) for x in d[3+n:] if x and x[0]!='=' and '=' in x];"
+                L"os.environ.clear();os.environ.update(e);"
+                L"sys.path[0]=os.path.dirname(os.path.abspath(sys.argv[0]));"
+                L"runpy.run_path(sys.argv[0],run_name='__main__')\"";
+
+        case PoolKind_Bash:
+            // same request layout as python.  PATH is left alone since msys has already converted
+            // its own copy into unix form, and the Windows form would break it.
+            return exe + L" -c " + escape_quotes(
+                L"mapfile -d '' f; cd -- \"${f[0]}\" || exit 1; n=${f[1]}; s=${f[2]}; "
+                L"set -- \"${f[@]:3:n}\"; "
+                L"for e in \"${f[@]:3+n}\"; do case $e in PATH=*|[!A-Za-z_]*) ;; *) export \"$e\" 2>/dev/null;; esac; done; "
+                L"unset f n e; . \"$s\""
+            );
+
+        case PoolKind_PowerShell:
+            // the request is plain PowerShell, read from stdin by -Command -.
+            return exe + L" -NoLogo -NoProfile -NonInteractive -Command -";
+    }
+    return {};
+}
+
+std::wstring ev_PowerShellQuote(const std::wstring& src)
+{
+    std::wstring result = L"'";
+    for (auto ch : src) {
+        if (ch == L'\'') result += L'\'';
+        result += ch;
+    }
+    return result + L"'";
+}
+
+std::string ev_PoolEncodeRequest(Ev_PoolKind kind, const std::wstring& script, const std::wstring& cwd, const ArgContainer& args, const ArgContainer& env)
+{
+    if (kind == PoolKind_PowerShell) {
+        std::wstring cmd = L"Set-Location -LiteralPath " + ev_PowerShellQuote(cwd) + L";";
+        for (const auto& var : env) {
+            auto eq = var.find(L'=', 1);
+            if (var.empty() || var[0] == L'=' || eq == std::wstring::npos) continue;
+            cmd += L"[Environment]::SetEnvironmentVariable(" + ev_PowerShellQuote(var.substr(0, eq)) + L"," + ev_PowerShellQuote(var.substr(eq + 1)) + L");";
+        }
+        cmd += L"& " + ev_PowerShellQuote(script);
+        for (const auto& arg : args) {
+            cmd += L" " + ev_PowerShellQuote(arg);
+        }
+        cmd += L"; exit $LASTEXITCODE\n";
+        return ev_ToUtf8(cmd);
+    }
+
+    ArgContainer fields = { cwd, xStringFormat(L"%d", int(args.size())), script };
+    fields.insert(fields.end(), args.begin(), args.end());
+    fields.insert(fields.end(), env .begin(), env .end());
+    return ev_ToUtf8(ev_PackStrings(fields));
+}
+
+bool ev_PoolStartInstance(const Ev_PoolHandler& handler, Ev_PoolInstance& inst)
+{
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, TRUE };
+    HANDLE inRead, inWrite, outRead, outWrite, errRead, errWrite;
+
+    if (!CreatePipe(&inRead, &inWrite, &sa, 0)) return false;
+    if (!CreatePipe(&outRead, &outWrite, &sa, 0)) {
+        CloseHandle(inRead);  CloseHandle(inWrite);
+        return false;
+    }
+    if (!CreatePipe(&errRead, &errWrite, &sa, 0)) {
+        CloseHandle(inRead);  CloseHandle(inWrite);
+        CloseHandle(outRead); CloseHandle(outWrite);
+        return false;
+    }
+
+    // our ends must not be inherited, or the instance would hold its own stdin open forever.
+    SetHandleInformation(inWrite, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(outRead, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(errRead, HANDLE_FLAG_INHERIT, 0);
+
+    HANDLE inherit[3] = { inRead, outWrite, errWrite };
+
+    SIZE_T attrSize = 0;
+    InitializeProcThreadAttributeList(nullptr, 1, 0, &attrSize);
+    std::vector<uint8_t> attrBuf(attrSize);
+    auto* attrs = (LPPROC_THREAD_ATTRIBUTE_LIST)attrBuf.data();
+    InitializeProcThreadAttributeList(attrs, 1, 0, &attrSize);
+    UpdateProcThreadAttribute(attrs, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherit, sizeof(inherit), nullptr, nullptr);
+
+    STARTUPINFOEXW si = {};
+    si.StartupInfo.cb           = sizeof(si);
+    si.StartupInfo.dwFlags      = STARTF_USESTDHANDLES;
+    si.StartupInfo.hStdInput    = inRead;
+    si.StartupInfo.hStdOutput   = outWrite;
+    si.StartupInfo.hStdError    = errWrite;
+    si.lpAttributeList          = attrs;
+
+    auto cmdline = ev_PoolBootstrapCommandLine(handler);
+    PROCESS_INFORMATION pi = {};
+    bool ok = CreateProcessW(nullptr, cmdline.data(), nullptr, nullptr, TRUE, EXTENDED_STARTUPINFO_PRESENT | CREATE_NO_WINDOW,
+        nullptr, nullptr, &si.StartupInfo, &pi) != FALSE;
+
+    DeleteProcThreadAttributeList(attrs);
+    CloseHandle(inRead);
+    CloseHandle(outWrite);
+    CloseHandle(errWrite);
+
+    if (!ok) {
+        CloseHandle(inWrite);
+        CloseHandle(outRead);
+        CloseHandle(errRead);
+        return false;
+    }
+
+    CloseHandle(pi.hThread);
+    inst.hProcess   = pi.hProcess;
+    inst.hStdIn     = inWrite;
+    inst.hStdOut    = outRead;
+    inst.hStdErr    = errRead;
+    return true;
+}
+
+void ev_PoolReleaseInstance(Ev_PoolInstance& inst, bool kill)
+{
+    if (kill) TerminateProcess(inst.hProcess, EXIT_FAILURE);
+    if (inst.hStdIn ) CloseHandle(inst.hStdIn );
+    if (inst.hStdOut) CloseHandle(inst.hStdOut);
+    if (inst.hStdErr) CloseHandle(inst.hStdErr);
+    CloseHandle(inst.hProcess);
+    inst = {};
+}
+
+// Reaps dead idle instances and tops every handler back up to its target, within the memory cap.
+// Instances are started outside the lock; a handler may briefly overshoot its target if two
+// maintenance passes race, which is harmless.
+void ev_PoolMaintain()
+{
+    while (!g_PoolStopping) {
+        Ev_PoolHandler* needy = nullptr;
+        uint64_t usage = 0;
+
+        EnterCriticalSection(&g_PoolLock);
+        for (auto& handler : g_PoolHandlers) {
+            for (size_t n=0; n<handler.idle.size(); ) {
+                if (WaitForSingleObject(handler.idle[n].hProcess, 0) == WAIT_OBJECT_0) {
+                    ev_PoolReleaseInstance(handler.idle[n], false);
+                    handler.idle.erase(handler.idle.begin() + n);
+                    continue;
+                }
+                PROCESS_MEMORY_COUNTERS mem = { sizeof(mem) };
+                if (GetProcessMemoryInfo(handler.idle[n].hProcess, &mem, sizeof(mem))) {
+                    usage += mem.WorkingSetSize;
+                }
+                ++n;
+            }
+            if (!needy && int(handler.idle.size()) < handler.target) {
+                needy = &handler;
+            }
+        }
+        LeaveCriticalSection(&g_PoolLock);
+
+        if (!needy || usage >= g_PoolMemCap) {
+            return;
+        }
+
+        // g_PoolHandlers is never resized after startup, so the pointer remains valid.
+        Ev_PoolInstance inst = {};
+        if (!ev_PoolStartInstance(*needy, inst)) {
+            log_error(L"WARN- pool: failed to start %s, Windows error 0x%08x\n", needy->interpreter.c_str(), GetLastError());
+            return;
+        }
+        EnterCriticalSection(&g_PoolLock);
+        needy->idle.push_back(inst);
+        LeaveCriticalSection(&g_PoolLock);
+    }
+}
+
+bool ev_OverlappedReadExact(HANDLE pipe, HANDLE evt, void* buf, DWORD len)
+{
+    auto* dest = (uint8_t*)buf;
+    while (len) {
+        DWORD xfer;
+        if (!ev_OverlappedIo(pipe, evt, false, dest, len, xfer) || !xfer) {
+            return false;
+        }
+        dest += xfer;
+        len  -= xfer;
+    }
+    return true;
+}
+
+struct Ev_PoolClient {
+    HANDLE              pipe;
+    CRITICAL_SECTION    writeLock;
+};
+
+bool ev_PoolSend(Ev_PoolClient& client, HANDLE evt, uint32_t type, const void* data, uint32_t len)
+{
+    Ev_PoolMsgHeader msg = { type, len };
+    EnterCriticalSection(&client.writeLock);
+    bool ok = ev_OverlappedWriteAll(client.pipe, evt, &msg, sizeof(msg)) && (!len || ev_OverlappedWriteAll(client.pipe, evt, data, len));
+    LeaveCriticalSection(&client.writeLock);
+    return ok;
+}
+
+struct Ev_PoolRelay {
+    Ev_PoolClient*      client;
+    HANDLE              source;
+    uint32_t            type;
+};
+
+DWORD WINAPI PoolRelayThread(void* param)
+{
+    auto& relay = *(Ev_PoolRelay*)param;
+    HANDLE evt = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    char buf[16384];
+    DWORD got;
+    while (ReadFile(relay.source, buf, sizeof(buf), &got, nullptr) && got) {
+        if (!ev_PoolSend(*relay.client, evt, relay.type, buf, got)) break;
+    }
+    CloseHandle(evt);
+    return 0;
+}
+
+void ev_PoolServeClient(HANDLE pipe)
+{
+    Ev_PoolClient client = { pipe };
+    InitializeCriticalSection(&client.writeLock);
+    HANDLE evt = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    Ev_PoolMsgHeader msg;
+    std::wstring payload;
+    bool valid = ev_OverlappedReadExact(pipe, evt, &msg, sizeof(msg)) && !(msg.length % sizeof(WCHAR)) && (msg.length < (1 << 20));
+    if (valid) {
+        payload.resize(msg.length / sizeof(WCHAR));
+        valid = !msg.length || ev_OverlappedReadExact(pipe, evt, payload.data(), msg.length);
+    }
+
+    auto fields = ev_UnpackStrings(payload);
+    valid = valid && !fields.empty() && (fields[0] == g_PoolSecret);
+
+    if (valid && msg.type == PoolMsg_Stop) {
+        InterlockedExchange(&g_PoolStopping, 1);
+        SetEvent(g_PoolWake);
+    }
+    else if (valid && msg.type == PoolMsg_Run && fields.size() >= 5) {
+        const auto& ext    = fields[1];
+        const auto& script = fields[2];
+        const auto& cwd    = fields[3];
+        auto numArgs       = size_t(_wtoi(fields[4].c_str()));
+        numArgs            = (numArgs > fields.size() - 5) ? fields.size() - 5 : numArgs;
+        ArgContainer args(fields.begin() + 5, fields.begin() + 5 + numArgs);
+        ArgContainer env (fields.begin() + 5 + numArgs, fields.end());
+
+        Ev_PoolHandler* handler = nullptr;
+        Ev_PoolInstance inst    = {};
+
+        EnterCriticalSection(&g_PoolLock);
+        for (auto& h : g_PoolHandlers) {
+            if (_wcsicmp(h.extension.c_str(), ext.c_str()) == 0) {
+                handler = &h;
+                break;
+            }
+        }
+        while (handler && !handler->idle.empty()) {
+            inst = handler->idle.front();
+            handler->idle.erase(handler->idle.begin());
+            if (WaitForSingleObject(inst.hProcess, 0) != WAIT_OBJECT_0) break;
+            ev_PoolReleaseInstance(inst, false);
+        }
+        LeaveCriticalSection(&g_PoolLock);
+
+        // pool ran dry: a cold start here is still cheaper than a UAC prompt on the client.
+        if (handler && !inst.hProcess && !ev_PoolStartInstance(*handler, inst)) {
+            handler = nullptr;
+        }
+        SetEvent(g_PoolWake);
+
+        if (!handler) {
+            ev_PoolSend(client, evt, PoolMsg_Decline, nullptr, 0);
+        }
+        else {
+            auto request = ev_PoolEncodeRequest(handler->kind, script, cwd, args, env);
+            DWORD wrote;
+            WriteFile(inst.hStdIn, request.data(), DWORD(request.size()), &wrote, nullptr);
+            CloseHandle(inst.hStdIn);
+            inst.hStdIn = nullptr;
+
+            Ev_PoolRelay errRelay = { &client, inst.hStdErr, PoolMsg_Stderr };
+            Ev_PoolRelay outRelay = { &client, inst.hStdOut, PoolMsg_Stdout };
+            HANDLE hErrThread = CreateThread(nullptr, 0, PoolRelayThread, &errRelay, 0, nullptr);
+            PoolRelayThread(&outRelay);
+            if (hErrThread) {
+                WaitForSingleObject(hErrThread, INFINITE);
+                CloseHandle(hErrThread);
+            }
+
+            DWORD procExitCode = EXIT_FAILURE;
+            WaitForSingleObject(inst.hProcess, INFINITE);
+            GetExitCodeProcess (inst.hProcess, &procExitCode);
+            ev_PoolReleaseInstance(inst, false);
+
+            int32_t exitCode = int32_t(procExitCode);
+            ev_PoolSend(client, evt, PoolMsg_Exit, &exitCode, sizeof(exitCode));
+        }
+    }
+    else {
+        ev_PoolSend(client, evt, PoolMsg_Decline, nullptr, 0);
+    }
+
+    FlushFileBuffers(pipe);
+    DisconnectNamedPipe(pipe);
+    CloseHandle(pipe);
+    CloseHandle(evt);
+    DeleteCriticalSection(&client.writeLock);
+}
+
+DWORD WINAPI PoolClientThread(void* param)
+{
+    ev_PoolServeClient((HANDLE)param);
+    InterlockedExchange64(&g_PoolLastRequest, LONG64(GetTickCount64()));
+    InterlockedDecrement(&g_PoolActive);
+    return 0;
+}
+
+// config: <poolId>,<idleSec>,<memMB>,<ext>:<count>[,<ext>:<count>...]
+// The secret is read from the init pipe, see PoolStart().
+int PoolServerMain(const WCHAR* config)
+{
+    ArgContainer parts;
+    for (const WCHAR* pos = config; ; ) {
+        auto* comma = wcschr(pos, L',');
+        parts.push_back(comma ? std::wstring(pos, comma) : std::wstring(pos));
+        if (!comma) break;
+        pos = comma + 1;
+    }
+    if (parts.size() < 4) {
+        return EXIT_FAILURE;
+    }
+
+    const auto& poolId  = parts[0];
+    int idleSec         = _wtoi(parts[1].c_str());
+    g_PoolMemCap        = uint64_t(_wtoi(parts[2].c_str())) * 1024 * 1024;
+
+    if (1) {
+        HANDLE init = CreateFile(ev_PoolInitPipeName(poolId).c_str(), GENERIC_READ, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (init == INVALID_HANDLE_VALUE) {
+            return EXIT_FAILURE;
+        }
+        WCHAR secret[xPoolSecretBytes * 2];
+        bool ok = ev_ReadExact(init, secret, sizeof(secret));
+        CloseHandle(init);
+        if (!ok) {
+            return EXIT_FAILURE;
+        }
+        g_PoolSecret.assign(secret, _countof(secret));
+    }
+
+    for (size_t n=3; n<parts.size(); ++n) {
+        auto colon = parts[n].find(L':');
+        Ev_PoolHandler handler = {};
+        handler.extension   = parts[n].substr(0, colon);
+        handler.target      = (colon == std::wstring::npos) ? 1 : _wtoi(parts[n].c_str() + colon + 1);
+
+        auto strCmd = ev_LookupAssocCommand(handler.extension);
+        int numArgs = 0;
+        auto* argv  = strCmd.empty() ? nullptr : ::CommandLineToArgvW(strCmd.c_str(), &numArgs);
+        if (argv && numArgs > 0) {
+            handler.interpreter = argv[0];
+            handler.kind        = ev_PoolDetectKind(handler.interpreter);
+        }
+        if (argv) LocalFree(argv);
+
+        if (!handler.kind) {
+            log_error(L"WARN- pool: no warm-start support for %s handler `%s`\n", handler.extension.c_str(), strCmd.c_str());
+            continue;
+        }
+        g_PoolHandlers.push_back(handler);
+    }
+
+    if (g_PoolHandlers.empty()) {
+        return EXIT_FAILURE;
+    }
+
+    // DACL: elevated Administrators (ie. us) get full access, which is needed to create further
+    // instances.  The user gets FILE_GENERIC_READ | FILE_WRITE_DATA | FILE_WRITE_ATTRIBUTES and
+    // crucially not FILE_CREATE_PIPE_INSTANCE, so a non-elevated process can't serve requests
+    // under our name.  Label: medium, so the non-elevated client is allowed to write.
+    std::wstring sddl;
+    if (1) {
+        HANDLE hToken;
+        OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &hToken);
+        DWORD size = 0;
+        GetTokenInformation(hToken, TokenUser, nullptr, 0, &size);
+        std::vector<uint8_t> buf(size);
+        WCHAR* sidString = nullptr;
+        if (GetTokenInformation(hToken, TokenUser, buf.data(), size, &size) &&
+            ConvertSidToStringSid(((TOKEN_USER*)buf.data())->User.Sid, &sidString)) {
+            sddl = xStringFormat(L"D:P(A;;GA;;;BA)(A;;0x0012018b;;;%s)S:(ML;;NW;;;ME)", sidString);
+            LocalFree(sidString);
+        }
+        CloseHandle(hToken);
+    }
+
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, FALSE };
+    if (sddl.empty() || !ConvertStringSecurityDescriptorToSecurityDescriptor(sddl.c_str(), SDDL_REVISION_1, &sa.lpSecurityDescriptor, nullptr)) {
+        return EXIT_FAILURE;
+    }
+
+    InitializeCriticalSection(&g_PoolLock);
+    g_PoolWake          = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    g_PoolLastRequest   = LONG64(GetTickCount64());
+    ev_PoolMaintain();
+
+    auto pipeName   = ev_PoolPipeName(poolId);
+    HANDLE evtConn  = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    DWORD firstFlag = FILE_FLAG_FIRST_PIPE_INSTANCE;
+
+    while (!g_PoolStopping) {
+        HANDLE pipe = CreateNamedPipe(pipeName.c_str(),
+            PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | firstFlag,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES, 64 * 1024, 64 * 1024, 0, &sa
+        );
+        if (pipe == INVALID_HANDLE_VALUE) {
+            break;
+        }
+        firstFlag = 0;
+
+        OVERLAPPED ov = {};
+        ov.hEvent = evtConn;
+        ResetEvent(evtConn);
+        bool connected = ConnectNamedPipe(pipe, &ov) != FALSE || GetLastError() == ERROR_PIPE_CONNECTED;
+        bool pending   = !connected && GetLastError() == ERROR_IO_PENDING;
+
+        while (pending && !g_PoolStopping) {
+            HANDLE waits[2] = { evtConn, g_PoolWake };
+            auto result = WaitForMultipleObjects(2, waits, FALSE, 1000);
+            if (result == WAIT_OBJECT_0) {
+                DWORD unused;
+                connected = GetOverlappedResult(pipe, &ov, &unused, FALSE) != FALSE;
+                break;
+            }
+            ev_PoolMaintain();
+
+            auto idleMs = GetTickCount64() - uint64_t(g_PoolLastRequest);
+            if (!g_PoolActive && idleMs >= uint64_t(idleSec) * 1000) {
+                InterlockedExchange(&g_PoolStopping, 1);
+            }
+        }
+
+        if (!connected) {
+            CancelIo(pipe);
+            CloseHandle(pipe);
+            continue;
+        }
+
+        InterlockedIncrement(&g_PoolActive);
+        InterlockedExchange64(&g_PoolLastRequest, LONG64(GetTickCount64()));
+        if (HANDLE hThread = CreateThread(nullptr, 0, PoolClientThread, pipe, 0, nullptr)) {
+            CloseHandle(hThread);
+        }
+        else {
+            CloseHandle(pipe);
+            InterlockedDecrement(&g_PoolActive);
+        }
+    }
+
+    // let in-flight requests finish relaying before the idle instances are torn down.
+    while (g_PoolActive) {
+        Sleep(50);
+    }
+
+    EnterCriticalSection(&g_PoolLock);
+    for (auto& handler : g_PoolHandlers) {
+        for (auto& inst : handler.idle) {
+            ev_PoolReleaseInstance(inst, true);
+        }
+        handler.idle.clear();
+    }
+    LeaveCriticalSection(&g_PoolLock);
+
+    LocalFree(sa.lpSecurityDescriptor);
+    return EXIT_SUCCESS;
+}
+
+bool ev_IsProcessElevated(DWORD pid)
+{
+    bool elevated = false;
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    HANDLE hToken;
+    if (hProcess && OpenProcessToken(hProcess, TOKEN_QUERY, &hToken)) {
+        TOKEN_ELEVATION elevation = {};
+        DWORD size;
+        elevated = GetTokenInformation(hToken, TokenElevation, &elevation, sizeof(elevation), &size) && elevation.TokenIsElevated;
+        CloseHandle(hToken);
+    }
+    if (hProcess) CloseHandle(hProcess);
+    return elevated;
+}
+
+// EUDO_POOL is <poolId>:<serverPid>:<secret>.  Returns false if the pool isn't configured or
+// reachable, or if whatever answers on its pipe isn't the elevated server we expect.
+bool ev_PoolConnect(std::wstring& secret, HANDLE& pipe)
+{
+    std::wstring value;
+    if (ev_GetEnvironmentVariable(L"EUDO_POOL", value) || value.empty()) {
+        return false;
+    }
+    auto colon1 = value.find(L':');
+    auto colon2 = (colon1 == std::wstring::npos) ? colon1 : value.find(L':', colon1 + 1);
+    if (colon2 == std::wstring::npos) {
+        return false;
+    }
+    auto serverPid = DWORD(wcstoul(value.c_str() + colon1 + 1, nullptr, 10));
+    secret = value.substr(colon2 + 1);
+
+    // SECURITY_IDENTIFICATION: the server has no business impersonating us.
+    // No GENERIC_WRITE: it includes FILE_APPEND_DATA (aka FILE_CREATE_PIPE_INSTANCE), which the
+    // pipe's DACL deliberately doesn't grant.
+    auto pipeName = ev_PoolPipeName(value.substr(0, colon1));
+    for (int attempt=0; attempt<2; ++attempt) {
+        pipe = CreateFile(pipeName.c_str(), FILE_GENERIC_READ | FILE_WRITE_DATA, 0, nullptr, OPEN_EXISTING,
+            SECURITY_SQOS_PRESENT | SECURITY_IDENTIFICATION, nullptr);
+        if (pipe != INVALID_HANDLE_VALUE) {
+            ULONG pid = 0;
+            if (!GetNamedPipeServerProcessId(pipe, &pid) || pid != serverPid || !ev_IsProcessElevated(pid)) {
+                log_error(L"WARN- pool pipe is not served by the elevated pool server; ignoring %%EUDO_POOL%%.\n");
+                CloseHandle(pipe);
+                return false;
+            }
+            return true;
+        }
+        // every instance busy between ConnectNamedPipe calls; the server creates another promptly.
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipe(pipeName.c_str(), 2000)) {
+            break;
+        }
+    }
+    return false;
+}
+
+bool ev_PoolSendRequest(HANDLE pipe, uint32_t type, const ArgContainer& fields)
+{
+    auto payload = ev_PackStrings(fields);
+    Ev_PoolMsgHeader msg = { type, uint32_t(payload.length() * sizeof(WCHAR)) };
+    DWORD wrote;
+    return WriteFile(pipe, &msg, sizeof(msg), &wrote, nullptr) && WriteFile(pipe, payload.data(), msg.length, &wrote, nullptr);
+}
+
+// Runs the script through the pool if there is one serving this extension.  Returns false if
+// the caller should go ahead and elevate the normal way.
+bool ev_PoolTryExec(const std::wstring& script, const std::wstring& extension, const ArgContainer& cmdargs, int& exitCode)
+{
+    std::wstring secret;
+    HANDLE pipe;
+    if (!ev_PoolConnect(secret, pipe)) {
+        return false;
+    }
+
+    WCHAR fullpath[xMaxPath];
+    if (!GetFullPathName(script.c_str(), xMaxPath, fullpath, nullptr)) {
+        CloseHandle(pipe);
+        return false;
+    }
+
+    // cmdargs have already been quoted for a command line; the interpreter wants them raw.
+    ArgContainer args;
+    if (!cmdargs.empty()) {
+        int numArgs = 0;
+        auto* argv  = ::CommandLineToArgvW((L"x " + xStringJoin(L" ", cmdargs)).c_str(), &numArgs);
+        for (int n=1; argv && n<numArgs; ++n) {
+            args.push_back(argv[n]);
+        }
+        if (argv) LocalFree(argv);
+    }
+
+    ArgContainer fields = { secret, extension, fullpath, ev_GetCurrentDir(), xStringFormat(L"%d", int(args.size())) };
+    fields.insert(fields.end(), args.begin(), args.end());
+    if (auto* envBlock = GetEnvironmentStringsW()) {
+        for (auto* var = envBlock; *var; var += wcslen(var) + 1) {
+            fields.push_back(var);
+        }
+        FreeEnvironmentStringsW(envBlock);
+    }
+
+    if (!ev_PoolSendRequest(pipe, PoolMsg_Run, fields)) {
+        CloseHandle(pipe);
+        return false;
+    }
+
+    HANDLE hStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    HANDLE hStdErr = GetStdHandle(STD_ERROR_HANDLE);
+    bool   handled = false;
+
+    std::vector<char> buf;
+    Ev_PoolMsgHeader msg;
+    while (ev_ReadExact(pipe, &msg, sizeof(msg))) {
+        buf.resize(msg.length);
+        if (msg.length && !ev_ReadExact(pipe, buf.data(), msg.length)) break;
+
+        DWORD wrote;
+        if (msg.type == PoolMsg_Stdout) {
+            WriteFile(hStdOut, buf.data(), msg.length, &wrote, nullptr);
+        }
+        else if (msg.type == PoolMsg_Stderr) {
+            WriteFile(hStdErr, buf.data(), msg.length, &wrote, nullptr);
+        }
+        else if (msg.type == PoolMsg_Exit && msg.length == sizeof(int32_t)) {
+            exitCode = *(const int32_t*)buf.data();
+            handled  = true;
+            break;
+        }
+        else {
+            break;
+        }
+    }
+    CloseHandle(pipe);
+
+    if (g_Verbose) {
+        log_console(L"Warm pool          = %s\n", handled ? L"used" : L"declined");
+    }
+    return handled;
+}
+
+int PoolStart(const std::wstring& handlerSpec, int idleSec, int memMB)
+{
+    BYTE random[xPoolSecretBytes];
+    HCRYPTPROV hProv;
+    if (!CryptAcquireContext(&hProv, nullptr, nullptr, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
+        log_error(L"ERROR- CryptAcquireContext failed, Windows error 0x%08x\n", GetLastError());
+        return EXIT_FAILURE;
+    }
+    bool gotRandom = CryptGenRandom(hProv, sizeof(random), random) != FALSE;
+    CryptReleaseContext(hProv, 0);
+    if (!gotRandom) {
+        log_error(L"ERROR- CryptGenRandom failed, Windows error 0x%08x\n", GetLastError());
+        return EXIT_FAILURE;
+    }
+
+    std::wstring secret;
+    for (auto b : random) {
+        secret += xStringFormat(L"%02x", b);
+    }
+
+    auto poolId = xStringFormat(L"%u-%u", GetCurrentProcessId(), GetTickCount());
+    auto params = xStringFormat(L"--pool-server=%s,%d,%d,%s", poolId.c_str(), idleSec, memMB, handlerSpec.c_str());
+
+    // The secret is never put on the server's command line, where any process of the user could
+    // read it.  It goes over a single-instance pipe, created before the server exists so that
+    // nothing else can own the name, and only once the connected client is known to be the
+    // process we elevated.
+    HANDLE initPipe = ev_CreateSingleInstancePipe(ev_PoolInitPipeName(poolId), PIPE_ACCESS_OUTBOUND);
+    if (initPipe == INVALID_HANDLE_VALUE) {
+        log_error(L"ERROR- failed to create pool init pipe, Windows error 0x%08x\n", GetLastError());
+        return EXIT_FAILURE;
+    }
+
+    auto selfPath = ev_GetModuleFileName();
+
+    SHELLEXECUTEINFO Shex = {};
+    Shex.cbSize         = sizeof( SHELLEXECUTEINFO );
+    Shex.fMask          = SEE_MASK_NO_CONSOLE | SEE_MASK_FLAG_NO_UI | SEE_MASK_NOCLOSEPROCESS;
+    Shex.lpVerb         = L"runas";
+    Shex.lpFile         = selfPath.c_str();
+    Shex.lpParameters   = params.c_str();
+    Shex.nShow          = SW_HIDE;
+
+    if (!ShellExecuteEx(&Shex))
+    {
+        HRESULT Err = HRESULT_FROM_WIN32(GetLastError());
+        log_error(L"ERROR- pool server could not be launched\nWindows Error 0x%08x - %s \n", Err, HRESULT_to_string(Err).c_str());
+        CloseHandle(initPipe);
+        return EXIT_FAILURE;
+    }
+
+    _ASSERTE(Shex.hProcess);
+
+    HANDLE evt = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    bool ok = ev_ConnectPipe(initPipe, Shex.hProcess) &&
+        ev_OverlappedWriteAll(initPipe, evt, secret.data(), DWORD(secret.length() * sizeof(WCHAR)));
+    if (ok) {
+        FlushFileBuffers(initPipe);
+    }
+    CloseHandle(evt);
+    CloseHandle(initPipe);
+
+    auto serverPid = GetProcessId(Shex.hProcess);
+    CloseHandle(Shex.hProcess);
+
+    if (!ok) {
+        log_error(L"ERROR- pool server did not start.\n");
+        return EXIT_FAILURE;
+    }
+
+    // printed in `set`-able form, eg.  for /f %%i in ('eudo --pool-start=.py:2') do set %%i
+    log_console(L"EUDO_POOL=%s:%u:%s\n", poolId.c_str(), serverPid, secret.c_str());
+    return EXIT_SUCCESS;
+}
+
+int PoolStop()
+{
+    std::wstring secret;
+    HANDLE pipe;
+    if (!ev_PoolConnect(secret, pipe)) {
+        log_error(L"ERROR- no warm pool is reachable via %%EUDO_POOL%%.\n");
+        return EXIT_FAILURE;
+    }
+    bool ok = ev_PoolSendRequest(pipe, PoolMsg_Stop, { secret });
+    CloseHandle(pipe);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int ExecAssoc(const std::wstring& executable_fullpath, const ArgContainer& cmdargs, const Ev_ShellExecFlags& flags_in)
+{
+    // Basic rules for executing a program on Windows are according to extension, which might seem odd to
+    // anyone with a strong background in software engineering.  Windows is also structured in such a way
+    // that it's tricky to launch processes directly and have them behave in a desired fashion, due to
+    // filetype associations requiring some amount of command shell variable expansion.
+    //
+    // The first step is determining the correct extension to look up out of the association table.
+    // If a file has _no extension_ then possible matches are created using $PATHEXT.  If any of the
+    // $PATHEXT extensions create a valid existing file, then that file and it's extension are used.
+    //
+    // A typical command shell association looks something like these:
+    //   Msi.Package="%SystemRoot%\System32\msiexec.exe" /i "%1" %*
+    //   sh_auto_file="C:\Program Files\Git\git-bash.exe" --no-cd "%L" %*
+    //
+    //      %1 - is the command itself
+    //      %L - appears to just be an alias for %1
+    //      %* - expands as all other parameters for the command
+    //
+    // The Good News:
+    //   Other types of expansion do _not_ appear to be supported.  For example, %~dp1 is not processed.
+    //   This reduces the scope of complexity to something we can reasonably simulate here.
+    //
+
+    auto resolveStart = ev_StatsNow();
+    auto extension    = FindBestExt(executable_fullpath);
+    auto exe_fullname = executable_fullpath + extension;
+    ev_StatsRecord(StatsPhase_Resolve, resolveStart);
+
+    // the pool is elevated by definition, so --no-elevate must never be routed through it.
+    if (!extension.empty() && !flags_in.DoNotWaitForProc && !flags_in.PseudoConsole && !flags_in.NoElevate && !g_Memo) {
+        // unlike exe_fullname, this doesn't double up an extension that was already specified.
+        auto script = (PathFindExtension(executable_fullpath.c_str())[0] == L'.') ? executable_fullpath : exe_fullname;
+        int exitCode;
+        if (ev_PoolTryExec(script, extension, cmdargs, exitCode)) {
+            return exitCode;
+        }
+    }
+
+    if (!extension.empty()) {
+        auto assocStart             = ev_StatsNow();
+        auto strCmd                 = ev_LookupAssocCommand(extension);
+        ev_StatsRecord(StatsPhase_Assoc, assocStart);
+
+        if (g_Verbose) {
+            auto strFriendlyProgramName = ev_AssocQueryString(ASSOCSTR_FRIENDLYAPPNAME, extension.c_str());
+            auto strExe                 = ev_AssocQueryString(ASSOCSTR_EXECUTABLE,      extension.c_str());
+            log_console(L"Assoc FriendlyName = %s\n", strFriendlyProgramName.c_str());
+            log_console(L"Assoc Command      = %s\n", strCmd.c_str());
+            log_console(L"Assoc Exe Fullpath = %s\n", strExe.c_str());
+        }
+
+        if (strCmd.empty()) {
+            log_error(L"%s: is not an executable program.", executable_fullpath.c_str());
+            _exit(EXIT_FAILURE);
+        }
+
+        // token replacement time!  Replace %1, %*, %L, etc.
+
+        exe_fullname = executable_fullpath;
+
+        auto CmdLineBuffer = ev_ExpandAssocCommand(strCmd, exe_fullname, cmdargs);
+
+        debug_log(L"Expanded Invocation= %s\n", CmdLineBuffer.c_str());
+
+        // ShellExecuteEx needs to have the Application/Command separated from the Command Arguments.
+        // Unfortunately the AssocQueryString returns everything together all-at-once.  Since it's _possible_ the
+        // association does something clever with %1 or %L, it's necessary for us to walk the string and get the
+        // filename out of it.
+        //
+        // Shortcut: use CommandLineToArgvW() and then re-quote the arguments.  It's a bit wasteful on cycles but
+        // it's oh-so-easy and 100% consistent with CMD behavior.
+
+        if (1) {
+            int numArgs;
+            auto* reparsed = ::CommandLineToArgvW(CmdLineBuffer.c_str(), &numArgs);
+            if (!reparsed || numArgs <= 0) {
+                log_error(L"ERROR- command line expansion failed.");
+                log_error(L"File type associated as -> %s", strCmd.c_str());
+            }
+            std::wstring reargs;
+            for (int n=1; n<numArgs; ++n) {
+                if (!reargs.empty()) {
+                    reargs += L" ";
+                }
+                reargs += escape_quotes(reparsed[n]);
+            }
+            return ShellExec(reparsed[0], reargs.c_str(), flags_in);
+        }
+    }
+    return ShellExec(exe_fullname.c_str(), xStringJoin(L" ", cmdargs).c_str(), flags_in);
+}
+
+// Native pipelines (--pipeline)
+//
+// Runs a small subset of CMD syntax without starting COMSPEC at all:
+//
+//    a | b            stdout of a connected to stdin of b via an anonymous pipe
+//    a && b, a || b   conditional on the exit code of the previous pipeline
+//    < file, > file, >> file, 2> file, 2>> file, 2>&1
+//
+// Quoting follows the CMD convention: double quotes group a word and are passed through to the
+// program untouched, there is no escape character, and operators inside quotes are literal.
+// There are no builtins -- every stage is a program, resolved via $PATHEXT and file associations
+// exactly as eudo resolves its own target.  Use `cmd /c` explicitly for things like `copy`.
+//
+// The pipeline text comes from eudo's own argv, in one of two forms:
+//
+//    eudo --pipeline "type a.txt | sort"
+//    eudo --pipeline sc query "My Service" "|" findstr RUNNING
+//
+// A single argument is the pipeline text itself, exactly as written, which is what PowerShell and
+// bash callers naturally use.  With several arguments the calling shell has already split them and
+// removed their quotes, so each argument that contains whitespace is quoted again as a single word
+// (see ev_PipelineQuoteArg), while everything else is joined as-is so that operators given as
+// separate arguments still work.
+//
+// The caller parses the pipeline up-front (so syntax errors are reported before the UAC prompt)
+// and then elevates a copy of eudo with --pipeline-host, which re-parses that text from its own
+// raw command line and runs it.  From there on it is never re-quoted, so there's no cmd.exe
+// quoting layer to get wrong.
+
+enum Ev_PipeTokenType {
+    PipeTok_Word,
+    PipeTok_Pipe,           // |
+    PipeTok_And,            // &&
+    PipeTok_Or,             // ||
+    PipeTok_In,             // <
+    PipeTok_Out,            // >
+    PipeTok_OutAppend,      // >>
+    PipeTok_Err,            // 2>
+    PipeTok_ErrAppend,      // 2>>
+    PipeTok_ErrToOut,       // 2>&1
+};
+
+struct Ev_PipeToken {
+    Ev_PipeTokenType    type;
+    std::wstring        text;       // words only, quotes preserved
+};
+
+struct Ev_PipeRedirect {
+    int                 fd;         // 0, 1, 2
+    bool                append;
+    bool                toStdout;   // 2>&1
+    std::wstring        path;       // dequoted
+};
+
+struct Ev_PipeStage {
+    ArgContainer                    words;
+    std::vector<Ev_PipeRedirect>    redirects;
+};
+
+enum Ev_PipeCondition {
+    PipeCond_Always,
+    PipeCond_IfSuccess,     // &&
+    PipeCond_IfFailure,     // ||
+};
+
+struct Ev_Pipeline {
+    Ev_PipeCondition                cond;
+    std::vector<Ev_PipeStage>       stages;
+};
+
+using Ev_PipeList = std::vector<Ev_Pipeline>;
+
+std::wstring ev_Dequote(const std::wstring& word)
+{
+    std::wstring result;
+    for (auto ch : word) {
+        if (ch != L'"') result += ch;
+    }
+    return result;
+}
+
+// Restores the grouping of an argument whose quotes were stripped by the calling shell.  An
+// argument that still contains quotes was deliberately quoted for the pipeline and is kept as-is.
+std::wstring ev_PipelineQuoteArg(const WCHAR* arg)
+{
+    if (wcschr(arg, L'"') || !wcspbrk(arg, L" \t")) {
+        return arg;
+    }
+    return xStringFormat(L"\"%s\"", arg);
+}
+
+bool ev_PipelineTokenize(const WCHAR* src, std::vector<Ev_PipeToken>& tokens, std::wstring& err)
+{
+    auto isOperator = [](WCHAR ch) { return ch == L'|' || ch == L'&' || ch == L'<' || ch == L'>'; };
+    auto isSpace    = [](WCHAR ch) { return ch == L' ' || ch == L'\t' || ch == L'\r' || ch == L'\n'; };
+
+    int i = 0;
+    while (1) {
+        while (src[i] && isSpace(src[i])) ++i;
+        if (!src[i]) break;
+
+        auto ch = src[i];
+        if (ch == L'|') {
+            if (src[i+1] == L'|') { tokens.push_back({ PipeTok_Or,   {} });  i += 2; }
+            else                  { tokens.push_back({ PipeTok_Pipe, {} });  i += 1; }
+        }
+        else if (ch == L'&') {
+            if (src[i+1] != L'&') {
+                err = L"`&` (background/sequential execution) is not supported; use `&&` or `||`.";
+                return false;
+            }
+            tokens.push_back({ PipeTok_And, {} });
+            i += 2;
+        }
+        else if (ch == L'<') {
+            tokens.push_back({ PipeTok_In, {} });
+            i += 1;
+        }
+        else if (ch == L'>') {
+            if (src[i+1] == L'>') { tokens.push_back({ PipeTok_OutAppend, {} });  i += 2; }
+            else                  { tokens.push_back({ PipeTok_Out,       {} });  i += 1; }
+        }
+        else if (ch == L'2' && src[i+1] == L'>') {
+            if (src[i+2] == L'&' && src[i+3] == L'1') { tokens.push_back({ PipeTok_ErrToOut,  {} });  i += 4; }
+            else if (src[i+2] == L'>')                { tokens.push_back({ PipeTok_ErrAppend, {} });  i += 3; }
+            else                                      { tokens.push_back({ PipeTok_Err,       {} });  i += 2; }
+        }
+        else {
+            std::wstring word;
+            bool quoted = false;
+            while (src[i]) {
+                if (src[i] == L'"') {
+                    quoted = !quoted;
+                }
+                else if (!quoted && (isSpace(src[i]) || isOperator(src[i]))) {
+                    break;
+                }
+                word += src[i];
+                ++i;
+            }
+            if (quoted) {
+                err = L"unterminated double quote.";
+                return false;
+            }
+            tokens.push_back({ PipeTok_Word, word });
+        }
+    }
+    return true;
+}
+
+bool ev_PipelineParse(const std::vector<Ev_PipeToken>& tokens, Ev_PipeList& list, std::wstring& err)
+{
+    Ev_Pipeline         pipeline    = { PipeCond_Always };
+    Ev_PipeStage        stage;
+    Ev_PipeRedirect*    pending     = nullptr;
+
+    auto finishStage = [&]() {
+        if (pending) {
+            err = L"redirection is missing a filename.";
+            return false;
+        }
+        if (stage.words.empty()) {
+            err = L"empty command in pipeline.";
+            return false;
+        }
+        pipeline.stages.push_back(std::move(stage));
+        stage = {};
+        return true;
+    };
+
+    for (const auto& tok : tokens) {
+        switch (tok.type) {
+            case PipeTok_Word:
+                if (pending) {
+                    pending->path = ev_Dequote(tok.text);
+                    pending = nullptr;
+                }
+                else {
+                    stage.words.push_back(tok.text);
+                }
+            break;
+
+            case PipeTok_Pipe:
+                if (!finishStage()) return false;
+            break;
+
+            case PipeTok_And:
+            case PipeTok_Or:
+                if (!finishStage()) return false;
+                list.push_back(std::move(pipeline));
+                pipeline = { (tok.type == PipeTok_And) ? PipeCond_IfSuccess : PipeCond_IfFailure };
+            break;
+
+            default: {
+                if (pending) {
+                    err = L"redirection is missing a filename.";
+                    return false;
+                }
+                Ev_PipeRedirect redir = {};
+                redir.fd        = (tok.type == PipeTok_In) ? 0 : (tok.type == PipeTok_Out || tok.type == PipeTok_OutAppend) ? 1 : 2;
+                redir.append    = (tok.type == PipeTok_OutAppend) || (tok.type == PipeTok_ErrAppend);
+                redir.toStdout  = (tok.type == PipeTok_ErrToOut);
+                stage.redirects.push_back(redir);
+                if (!redir.toStdout) {
+                    pending = &stage.redirects.back();
+                }
+            }
+            break;
+        }
+    }
+
+    if (!finishStage()) return false;
+    list.push_back(std::move(pipeline));
+    return true;
+}
+
+bool ev_PipelineCompile(const WCHAR* src, Ev_PipeList& list, std::wstring& err)
+{
+    std::vector<Ev_PipeToken> tokens;
+    return ev_PipelineTokenize(src, tokens, err) && ev_PipelineParse(tokens, list, err);
+}
+
+// Builds the CreateProcess command line for a stage.  Executables go through unmodified, anything
+// else is expanded through its file association, same as ExecAssoc().
+bool ev_PipelineStageCommandLine(const Ev_PipeStage& stage, std::wstring& cmdline, std::wstring& err)
+{
+    auto program   = ev_Dequote(stage.words[0]);
+    auto extension = FindBestExt(program);
+
+    ArgContainer args(stage.words.begin() + 1, stage.words.end());
+
+    if (extension.empty() || _wcsicmp(extension.c_str(), L".exe") == 0 || _wcsicmp(extension.c_str(), L".com") == 0) {
+        cmdline = xStringJoin(L" ", stage.words);
+        return true;
+    }
+
+    auto strCmd = ev_LookupAssocCommand(extension);
+    if (strCmd.empty()) {
+        err = xStringFormat(L"%s: is not an executable program.", program.c_str());
+        return false;
+    }
+
+    auto exe_fullname = (PathFindExtension(program.c_str())[0] == L'.') ? program : program + extension;
+    cmdline = ev_ExpandAssocCommand(strCmd, exe_fullname, args);
+    return true;
+}
+
+HANDLE ev_InheritableDup(HANDLE h)
+{
+    HANDLE dup = nullptr;
+    if (!h || h == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    auto self = GetCurrentProcess();
+    if (!DuplicateHandle(self, h, self, &dup, 0, TRUE, DUPLICATE_SAME_ACCESS)) {
+        return nullptr;
+    }
+    return dup;
+}
+
+HANDLE ev_OpenRedirect(const Ev_PipeRedirect& redir)
+{
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, TRUE };
+    if (redir.fd == 0) {
+        return CreateFile(redir.path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+    if (redir.append) {
+        return CreateFile(redir.path.c_str(), FILE_APPEND_DATA | SYNCHRONIZE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+    return CreateFile(redir.path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+}
+
+void ev_CloseOwned(std::vector<HANDLE>& handles)
+{
+    for (auto h : handles) {
+        if (h && h != INVALID_HANDLE_VALUE) CloseHandle(h);
+    }
+    handles.clear();
+}
+
+// Runs one `|`-connected pipeline and returns the exit code of its last stage.
+int ev_PipelineRun(const Ev_Pipeline& pipeline, const std::wstring& cwd, HANDLE stdIn, HANDLE stdOut, HANDLE stdErr)
+{
+    std::vector<HANDLE> processes;
+    HANDLE  nextIn      = stdIn;
+    bool    launchFail  = false;
+
+    for (size_t n=0; n<pipeline.stages.size(); ++n) {
+        const auto& stage   = pipeline.stages[n];
+        bool        isLast  = (n+1 == pipeline.stages.size());
+
+        // handles opened for this stage only, closed as soon as the child has its own copies.
+        std::vector<HANDLE> owned;
+
+        HANDLE hIn  = nextIn;
+        HANDLE hOut = stdOut;
+        HANDLE hErr = stdErr;
+        if (hIn != stdIn) owned.push_back(hIn);
+
+        nextIn = stdIn;
+        if (!isLast) {
+            SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, TRUE };
+            HANDLE pipeRead, pipeWrite;
+            if (!CreatePipe(&pipeRead, &pipeWrite, &sa, 0)) {
+                log_error(L"ERROR- CreatePipe failed, Windows error 0x%08x\n", GetLastError());
+                ev_CloseOwned(owned);
+                launchFail = true;
+                break;
+            }
+            hOut   = pipeWrite;
+            nextIn = pipeRead;
+            owned.push_back(pipeWrite);
+        }
+
+        bool redirFail = false;
+        for (const auto& redir : stage.redirects) {
+            if (redir.toStdout) {
+                hErr = hOut;
+                continue;
+            }
+            HANDLE h = ev_OpenRedirect(redir);
+            if (h == INVALID_HANDLE_VALUE) {
+                log_error(L"ERROR- %s: cannot open for redirection, Windows error 0x%08x\n", redir.path.c_str(), GetLastError());
+                redirFail = true;
+                break;
+            }
+            owned.push_back(h);
+            if      (redir.fd == 0) hIn  = h;
+            else if (redir.fd == 1) hOut = h;
+            else                    hErr = h;
+        }
+
+        std::wstring cmdline;
+        std::wstring err;
+        if (!redirFail && !ev_PipelineStageCommandLine(stage, cmdline, err)) {
+            log_error(L"ERROR- %s\n", err.c_str());
+            redirFail = true;
+        }
+
+        if (redirFail) {
+            // downstream stages still run and simply see EOF, as they would under CMD.
+            ev_CloseOwned(owned);
+            if (isLast) launchFail = true;
+            continue;
+        }
+
+        debug_log(L"Pipeline stage     = %s\n", cmdline.c_str());
+
+        // Only the three std handles may leak into the child.  Without the explicit handle list
+        // every child inherits every pipe end we currently hold, and no stage ever sees EOF.
+        HANDLE inherit[3];
+        DWORD  numInherit = 0;
+        for (auto h : { hIn, hOut, hErr }) {
+            bool dupe = false;
+            for (DWORD k=0; k<numInherit; ++k) dupe = dupe || (inherit[k] == h);
+            if (h && !dupe) inherit[numInherit++] = h;
+        }
+
+        SIZE_T attrSize = 0;
+        InitializeProcThreadAttributeList(nullptr, 1, 0, &attrSize);
+        std::vector<uint8_t> attrBuf(attrSize);
+        auto* attrs = (LPPROC_THREAD_ATTRIBUTE_LIST)attrBuf.data();
+        InitializeProcThreadAttributeList(attrs, 1, 0, &attrSize);
+        UpdateProcThreadAttribute(attrs, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherit, numInherit * sizeof(HANDLE), nullptr, nullptr);
+
+        STARTUPINFOEXW si = {};
+        si.StartupInfo.cb           = sizeof(si);
+        si.StartupInfo.dwFlags      = STARTF_USESTDHANDLES;
+        si.StartupInfo.hStdInput    = hIn;
+        si.StartupInfo.hStdOutput   = hOut;
+        si.StartupInfo.hStdError    = hErr;
+        si.lpAttributeList          = attrs;
+
+        PROCESS_INFORMATION pi = {};
+        if (CreateProcessW(nullptr, cmdline.data(), nullptr, nullptr, TRUE, EXTENDED_STARTUPINFO_PRESENT,
+                nullptr, cwd.c_str(), &si.StartupInfo, &pi)) {
+            CloseHandle(pi.hThread);
+            processes.push_back(pi.hProcess);
+        }
+        else {
+            HRESULT Err = HRESULT_FROM_WIN32(GetLastError());
+            log_error(L"%s could not be launched\nWindows Error 0x%08x - %s \n", stage.words[0].c_str(), Err, HRESULT_to_string(Err).c_str());
+            if (isLast) launchFail = true;
+        }
+
+        DeleteProcThreadAttributeList(attrs);
+        ev_CloseOwned(owned);
+    }
+
+    if (nextIn != stdIn) {
+        CloseHandle(nextIn);
+    }
+
+    DWORD procExitCode = EXIT_FAILURE;
+    for (auto hProcess : processes) {
+        WaitForSingleObject(hProcess, INFINITE);
+        GetExitCodeProcess (hProcess, &procExitCode);
+        CloseHandle        (hProcess);
+    }
+    return launchFail ? EXIT_FAILURE : int(procExitCode);
+}
+
+int ev_PipelineRunList(const Ev_PipeList& list, const std::wstring& cwd)
+{
+    // std handles of this process may not be inheritable (console handles on Win8+ are real
+    // handles, but aren't created inheritable), and PROC_THREAD_ATTRIBUTE_HANDLE_LIST requires
+    // that they are.  So duplicate them once up-front.
+    HANDLE stdIn  = ev_InheritableDup(GetStdHandle(STD_INPUT_HANDLE ));
+    HANDLE stdOut = ev_InheritableDup(GetStdHandle(STD_OUTPUT_HANDLE));
+    HANDLE stdErr = ev_InheritableDup(GetStdHandle(STD_ERROR_HANDLE ));
+
+    int exitCode = EXIT_SUCCESS;
+    for (const auto& pipeline : list) {
+        if (pipeline.cond == PipeCond_IfSuccess && exitCode != 0) continue;
+        if (pipeline.cond == PipeCond_IfFailure && exitCode == 0) continue;
+        exitCode = ev_PipelineRun(pipeline, cwd, stdIn, stdOut, stdErr);
+    }
+
+    if (stdIn ) CloseHandle(stdIn );
+    if (stdOut) CloseHandle(stdOut);
+    if (stdErr) CloseHandle(stdErr);
+    return exitCode;
+}
+
+int PipelineHostMain()
+{
+    // Runs elevated.  Everything after the switch on our own raw command line is
+    //    "<cwd>" <pipeline text>
+    // ... parsed with the pipeline tokenizer rather than CommandLineToArgvW, so that nothing
+    // about the original text (quotes, backslashes) is reinterpreted.
+
+    static const WCHAR marker[] = L" --pipeline-host ";
+    auto* raw = wcsstr(GetCommandLineW(), marker);
+    if (!raw) {
+        log_error(L"ERROR- --pipeline-host is for internal use only.\n");
+        return EXIT_FAILURE;
+    }
+    raw += _countof(marker) - 1;
+
+    std::vector<Ev_PipeToken> tokens;
+    std::wstring err;
+    Ev_PipeList list;
+
+    if (!ev_PipelineTokenize(raw, tokens, err) || tokens.empty() || tokens[0].type != PipeTok_Word) {
+        log_error(L"ERROR- malformed pipeline host command line. %s\n", err.c_str());
+        return EXIT_FAILURE;
+    }
+    auto cwd = ev_Dequote(tokens[0].text);
+    tokens.erase(tokens.begin());
+
+    if (!ev_PipelineParse(tokens, list, err)) {
+        log_error(L"ERROR- pipeline syntax: %s\n", err.c_str());
+        return EXIT_FAILURE;
+    }
+
+    // set it on ourselves as well, so that relative redirection paths and $PATHEXT probing
+    // resolve against the caller's directory.
+    SetCurrentDirectory(cwd.c_str());
+    return ev_PipelineRunList(list, cwd);
+}
+
+int ExecPipeline(const ArgContainer& cmdargs, const Ev_ShellExecFlags& flags)
+{
+    std::wstring text;
+    if (cmdargs.size() == 1) {
+        text = cmdargs[0];
+    }
+    else {
+        for (const auto& arg : cmdargs) {
+            if (!text.empty()) {
+                text += L" ";
+            }
+            text += ev_PipelineQuoteArg(arg.c_str());
+        }
+    }
+
+    Ev_PipeList list;
+    std::wstring err;
+    if (!ev_PipelineCompile(text.c_str(), list, err)) {
+        log_error(L"ERROR- pipeline syntax: %s\n", err.c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto params = xStringFormat(L"--pipeline-host \"%s\" %s", ev_GetCurrentDir().c_str(), text.c_str());
+    if (params.length() >= xMaxEnviron) {
+        log_error(L"ERROR- Command Line too long\n");
+        return EXIT_FAILURE;
+    }
+    return ShellExec(ev_GetModuleFileName().c_str(), params.c_str(), flags);
+}
+
+// Built-in file operations (--cp, --mkdir, --rm, --chmod)
+//
+// A lot of elevation exists only to put a file somewhere protected.  Doing that through
+// `cmd /C copy` costs a COMSPEC startup per step and all of CMD's quoting rules.  Instead eudo
+// elevates itself with --fileops-host and performs the whole batch in-process, in order, stopping
+// at the first failure.
+//
+// Paths are made absolute by the caller, so the host doesn't care about its cwd.  The batch is
+// passed on the host's command line as `verb "arg" ["arg"]...` and read back raw with the
+// pipeline tokenizer, so nothing is re-quoted along the way (paths can't contain `"`).
+//
+// The host runs with a hidden window, so it can't usefully print errors.  Instead the caller
+// creates a single-instance result pipe before elevating, and the host writes an Ev_FileOpsResult
+// into it naming the failing operation and its Windows error, which the caller then reports.
+// The result only ever feeds an error message, so nothing trusts it beyond that.
+//
+// To compare against CMD, --load-test accepts file operations and -c in place of a program:
+//    eudo --load-test=100 --cp big.iso D:\dest\
+//    eudo --load-test=100 -c copy /y big.iso D:\dest\
+
+enum Ev_FileOpVerb {
+    FileOp_Copy,
+    FileOp_Mkdir,
+    FileOp_Remove,
+    FileOp_Chmod,
+};
+
+struct Ev_FileOp {
+    Ev_FileOpVerb   verb;
+    std::wstring    path;
+    std::wstring    arg;        // copy destination, or chmod mode
+};
+
+struct Ev_FileOpsResult {
+    uint32_t        failedIndex;    // 1-based, or 0 if every operation succeeded
+    uint32_t        error;          // Win32 error of the failed operation
+};
+
+// files at least this large are copied unbuffered: the cache would only be polluted by them, and
+// CopyFileEx moves big unbuffered chunks far more efficiently.  Small files stay cached, where
+// unbuffered I/O would be a net loss.
+static const int64_t xFileOpsUnbufferedMin  = 32ll * 1024 * 1024;
+
+static const struct {
+    Ev_FileOpVerb   verb;
+    const WCHAR*    name;
+    int             numArgs;
+} xFileOpVerbs[] = {
+    { FileOp_Copy,      L"cp",      2 },
+    { FileOp_Mkdir,     L"mkdir",   1 },
+    { FileOp_Remove,    L"rm",      1 },
+    { FileOp_Chmod,     L"chmod",   2 },
+};
+
+std::wstring ev_GetFullPath(const WCHAR* path)
+{
+    auto reqsize = GetFullPathName(path, 0, nullptr, nullptr);
+    if (!reqsize) {
+        return path;
+    }
+    std::wstring result;
+    result.resize(reqsize);
+    auto newsize = GetFullPathName(path, reqsize, result.data(), nullptr);
+    result.resize(newsize);
+    return result;
+}
+
+// mode is a sequence of +/- followed by any of r(eadonly), h(idden), s(ystem), a(rchive),
+// eg. "+r", "-h", "+rh-a".
+bool ev_ParseChmodMode(const WCHAR* mode, DWORD& setMask, DWORD& clearMask)
+{
+    setMask   = 0;
+    clearMask = 0;
+    DWORD* target = nullptr;
+
+    for (; *mode; ++mode) {
+        DWORD attr = 0;
+        switch (*mode) {
+            case L'+': target = &setMask;   continue;
+            case L'-': target = &clearMask; continue;
+            case L'r': attr = FILE_ATTRIBUTE_READONLY;  break;
+            case L'h': attr = FILE_ATTRIBUTE_HIDDEN;    break;
+            case L's': attr = FILE_ATTRIBUTE_SYSTEM;    break;
+            case L'a': attr = FILE_ATTRIBUTE_ARCHIVE;   break;
+            default:   return false;
+        }
+        if (!target) return false;
+        *target |= attr;
+    }
+    return (setMask | clearMask) != 0;
+}
+
+std::wstring ev_FileOpsPipeName(const WCHAR* pipeId)
+{
+    return xStringFormat(L"\\\\.\\pipe\\eudo-fileops-%s", pipeId);
+}
+
+// returns ERROR_SUCCESS or the Win32 error of the failed operation.
+DWORD ev_FileOpRun(const Ev_FileOp& op)
+{
+    switch (op.verb) {
+        case FileOp_Copy: {
+            // like `copy`: a destination directory receives the file under its own name.
+            auto dest = op.arg;
+            auto destAttr = GetFileAttributes(dest.c_str());
+            if (destAttr != INVALID_FILE_ATTRIBUTES && (destAttr & FILE_ATTRIBUTE_DIRECTORY)) {
+                dest += L"\\";
+                dest += PathFindFileName(op.path.c_str());
+            }
+
+            WIN32_FILE_ATTRIBUTE_DATA info;
+            if (!GetFileAttributesEx(op.path.c_str(), GetFileExInfoStandard, &info)) {
+                return GetLastError();
+            }
+            auto size = (int64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+
+            DWORD copyFlags = 0;
+            if (size >= xFileOpsUnbufferedMin) {
+                copyFlags |= COPY_FILE_NO_BUFFERING;
+            }
+            if (!CopyFileEx(op.path.c_str(), dest.c_str(), nullptr, nullptr, nullptr, copyFlags)) {
+                return GetLastError();
+            }
+            return ERROR_SUCCESS;
+        }
+
+        case FileOp_Mkdir: {
+            // creates intermediate directories too, and an existing directory is success.
+            auto hr = SHCreateDirectoryEx(nullptr, op.path.c_str(), nullptr);
+            if (hr != ERROR_SUCCESS && hr != ERROR_ALREADY_EXISTS && hr != ERROR_FILE_EXISTS) {
+                return DWORD(hr);
+            }
+            auto attr = GetFileAttributes(op.path.c_str());
+            if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY)) {
+                return ERROR_ALREADY_EXISTS;
+            }
+            return ERROR_SUCCESS;
+        }
+
+        case FileOp_Remove: {
+            // deliberately not recursive: directories must be empty.
+            auto attr = GetFileAttributes(op.path.c_str());
+            bool ok = (attr != INVALID_FILE_ATTRIBUTES) && ((attr & FILE_ATTRIBUTE_DIRECTORY)
+                ? RemoveDirectory(op.path.c_str())
+                : DeleteFile     (op.path.c_str()));
+            return ok ? ERROR_SUCCESS : GetLastError();
+        }
+
+        case FileOp_Chmod: {
+            DWORD setMask, clearMask;
+            if (!ev_ParseChmodMode(op.arg.c_str(), setMask, clearMask)) {
+                return ERROR_INVALID_PARAMETER;
+            }
+            auto attr = GetFileAttributes(op.path.c_str());
+            if (attr == INVALID_FILE_ATTRIBUTES) {
+                return GetLastError();
+            }
+            attr = (attr | setMask) & ~clearMask;
+            if (!SetFileAttributes(op.path.c_str(), attr ? attr : FILE_ATTRIBUTE_NORMAL)) {
+                return GetLastError();
+            }
+            return ERROR_SUCCESS;
+        }
+    }
+    return ERROR_INVALID_FUNCTION;
+}
+
+Ev_FileOpsResult ev_FileOpsRunAll(const std::vector<Ev_FileOp>& ops)
+{
+    for (size_t n=0; n<ops.size(); ++n) {
+        if (auto err = ev_FileOpRun(ops[n])) {
+            return { uint32_t(n + 1), uint32_t(err) };
+        }
+    }
+    return { 0, ERROR_SUCCESS };
+}
+
+// the operation as it would be given on eudo's command line.
+std::wstring ev_DescribeFileOp(const Ev_FileOp& op)
+{
+    switch (op.verb) {
+        case FileOp_Copy:   return L"--cp "    + escape_quotes(op.path.c_str()) + L" " + escape_quotes(op.arg.c_str());
+        case FileOp_Mkdir:  return L"--mkdir " + escape_quotes(op.path.c_str());
+        case FileOp_Remove: return L"--rm "    + escape_quotes(op.path.c_str());
+        case FileOp_Chmod:  return L"--chmod " + op.arg + L" " + escape_quotes(op.path.c_str());
+    }
+    return {};
+}
+
+// Consumes the arguments of a file operation switch from the command line.  Returns the number of
+// arguments consumed, or -1 if they are missing or invalid.
+int ev_ParseFileOp(const WCHAR* switchName, int Argc, WCHAR* Argv[], int i, std::vector<Ev_FileOp>& ops)
+{
+    for (const auto& desc : xFileOpVerbs) {
+        if (wcscmp(switchName, desc.name) != 0) continue;
+
+        if (i + desc.numArgs >= Argc) {
+            log_error(L"ERROR- --%s requires %d argument(s)\n", desc.name, desc.numArgs);
+            return -1;
         }
-        else {
-            thisExt += curch;
+
+        Ev_FileOp op;
+        op.verb = desc.verb;
+        op.path = ev_GetFullPath(Argv[i+1]);
+        if (desc.verb == FileOp_Copy) {
+            op.arg = ev_GetFullPath(Argv[i+2]);
+        }
+        else if (desc.verb == FileOp_Chmod) {
+            // chmod is `--chmod <mode> <path>`, like the real thing.
+            op.arg  = Argv[i+1];
+            op.path = ev_GetFullPath(Argv[i+2]);
+
+            DWORD setMask, clearMask;
+            if (!ev_ParseChmodMode(op.arg.c_str(), setMask, clearMask)) {
+                log_error(L"ERROR- --chmod mode `%s` not understood; expected eg. +r, -h, +rh-a\n", op.arg.c_str());
+                return -1;
+            }
         }
+        ops.push_back(op);
+        return desc.numArgs;
     }
+    return -1;
 }
 
-std::wstring escape_quotes(const WCHAR* src)
+bool ev_IsFileOpSwitch(const WCHAR* switchName)
 {
-    if (!src) return {};
+    for (const auto& desc : xFileOpVerbs) {
+        if (wcscmp(switchName, desc.name) == 0) return true;
+    }
+    return false;
+}
 
-    bool hasSpace = 0;
-    std::wstring result;
-    while(src[0]) {
-        if (src[0] == L'"') {
-            result += L"\\";
+int FileOpsHostMain()
+{
+    // Runs elevated.  Everything after the switch on our own raw command line is the result pipe
+    // id followed by the batch:
+    //    <pipeId> verb "arg" ["arg"] verb "arg" ...
+
+    static const WCHAR marker[] = L" --fileops-host ";
+    auto* raw = wcsstr(GetCommandLineW(), marker);
+    if (!raw) {
+        log_error(L"ERROR- --fileops-host is for internal use only.\n");
+        return EXIT_FAILURE;
+    }
+    raw += _countof(marker) - 1;
+
+    std::vector<Ev_PipeToken> tokens;
+    std::wstring err;
+    if (!ev_PipelineTokenize(raw, tokens, err) || tokens.empty() || tokens[0].type != PipeTok_Word) {
+        log_error(L"ERROR- malformed file operations: %s\n", err.c_str());
+        return EXIT_FAILURE;
+    }
+    auto pipeId = tokens[0].text;
+
+    std::vector<Ev_FileOp> ops;
+    for (size_t t=1; t<tokens.size(); ) {
+        bool matched = false;
+        for (const auto& desc : xFileOpVerbs) {
+            if (tokens[t].type != PipeTok_Word || tokens[t].text != desc.name) continue;
+            if (t + desc.numArgs >= tokens.size()) break;
+
+            Ev_FileOp op;
+            op.verb = desc.verb;
+            op.path = ev_Dequote(tokens[t+1].text);
+            if (desc.numArgs == 2) {
+                op.arg = ev_Dequote(tokens[t+2].text);
+            }
+            ops.push_back(op);
+            t += 1 + desc.numArgs;
+            matched = true;
+            break;
+        }
+        if (!matched) {
+            log_error(L"ERROR- malformed file operations near `%s`\n", tokens[t].text.c_str());
+            return EXIT_FAILURE;
         }
-        hasSpace = hasSpace || (src[0] == L' ') || (src[0] == L'\t') || (src[0] == L'\r') || (src[0] == L'\n');
-        result += src[0];
-        ++src;
     }
 
-    // only add double quotes if whitespace detected.
-    // Ensures we get as much out of the max-allowed xMaxEnviron length as possible.
+    auto result = ev_FileOpsRunAll(ops);
 
-    if (hasSpace) {
-        return L"\"" + result + L"\"";
-    }
-    else {
-        return result;
+    // best effort: without the pipe the caller still gets the exit code, just not the details.
+    HANDLE pipe = CreateFile(ev_FileOpsPipeName(pipeId.c_str()).c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (pipe != INVALID_HANDLE_VALUE) {
+        DWORD wrote;
+        WriteFile(pipe, &result, sizeof(result), &wrote, nullptr);
+        CloseHandle(pipe);
     }
+    return result.failedIndex ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-int ExecComspec(const ArgContainer& cmdargs, const Ev_ShellExecFlags& flags_in)
+int ExecFileOps(const std::vector<Ev_FileOp>& ops, const Ev_ShellExecFlags& flags_in)
 {
-    std::wstring environVarBuffer;
-    std::wstring CmdLineBuffer;
+    auto pipeId = xStringFormat(L"%u-%u", GetCurrentProcessId(), GetTickCount());
+    HANDLE pipe = ev_CreateSingleInstancePipe(ev_FileOpsPipeName(pipeId.c_str()), PIPE_ACCESS_INBOUND);
+    if (pipe == INVALID_HANDLE_VALUE) {
+        HRESULT Err = HRESULT_FROM_WIN32(GetLastError());
+        log_error(L"ERROR- failed to create file operations result pipe.\nWindows Error 0x%08x - %s\n", Err, HRESULT_to_string(Err).c_str());
+        return EXIT_FAILURE;
+    }
 
-    Ev_ShellExecFlags flags = flags_in;
-    if (flags.HideWindow && flags.ComspecRemains) {
-        log_error(L"WARN- refusing to hide an interactive COMSPEC since it leads to\n");
-        log_error(L"  an orphaned process.\n");
+    // serialized with the path first for every verb; the host doesn't need chmod's CLI order.
+    std::wstring params = L"--fileops-host " + pipeId;
+    for (const auto& op : ops) {
+        for (const auto& desc : xFileOpVerbs) {
+            if (desc.verb != op.verb) continue;
+            params += xStringFormat(L" %s \"%s\"", desc.name, op.path.c_str());
+            if (desc.numArgs == 2) {
+                params += xStringFormat(L" \"%s\"", op.arg.c_str());
+            }
+        }
     }
 
-    if (HRESULT hr = ev_GetEnvironmentVariable( L"COMSPEC", environVarBuffer)) {
-        log_error(L"ERROR- %%COMSPEC%% environment variable is undefined or empty.\n");
-        log_error(L"  %%COMSPEC%% must be defined when specifying switches -c|-k\n");
-        _exit(EXIT_FAILURE);
+    if (params.length() >= xMaxEnviron) {
+        log_error(L"ERROR- Command Line too long; split the file operations over several calls.\n");
+        CloseHandle(pipe);
+        return EXIT_FAILURE;
     }
 
-    // As of Windows 8, there's a security restriction that prevents cmd.exe from running inside
-    // the CWD when elevated to administrator.  This is no doubt some hurried cheap workaround
-    // for some silly user-opt-in security problem that is more correctly solved by telling
-    // users to stop downloading and running untrusted software.  But since this is Microsoft's
-    // world, we all have to pay the piper for the idiocy of the lowest common denominator.
-    //
-    // The workaround is instead of running the command directly, to do this:
-    //    cd /d %CWD%  && [actual-command]
-    //
-    // (if you're wondering how the Win8 policy change is supposed to protect anything when the
-    //  workaround is really that easy, then please join the club and scratch your head).
-    //
-    // But there is one small caveat:
-    //
-    //   $ cmd /C cd /d c:\mydir && echo success
-    //
-    // ... somehow executes cmd /C cd /d c:\mydir, and then runs `echo success` after the CMD is closed.
-    //     This happens from both the cmd prompt and from ShellExecuteEx().  But there's a workaround:
-    //
-    //   $ cmd /C " cd /d c:\mydir && echo success
-    //
-    // Yup, just add that quote.  CMD has some twisted bizarre way of handling quotes and nested quotes.
-    // while parsing /C and /K:  As far as I can tell, a double-quote at the start of the command will
-    // direct cmd.exe to interpret the rest of the command line as a single command -- no need to escape
-    // nested quotes or even provide the closing quote.  So that's what we do!
+    Ev_ShellExecFlags flags = flags_in;
+    flags.HideWindow        = 1;
+    if (flags.DoNotWaitForProc) {
+        log_error(L"Warning- --nowait is ignored for file operations.\n");
+        flags.DoNotWaitForProc = 0;
+    }
 
-    //                                  \/  and there's our mystery quote that makes it all work.
-    CmdLineBuffer = xStringFormat(L"/%c \" cd /d \"%s\" %s %s",
-        flags.ComspecRemains ? L'K' : L'C',
-        ev_GetCurrentDir().c_str(),
-        cmdargs.size() ? L"&&" : L"",
-        xStringJoin(L" ", cmdargs).c_str()
-    );
-    return ShellExec(environVarBuffer.c_str(), CmdLineBuffer.c_str(), flags);
+    auto result = ShellExec(ev_GetModuleFileName().c_str(), params.c_str(), flags);
+
+    // The host has exited by now.  If it connected, whatever it wrote is still buffered in the
+    // pipe; if it never got that far (eg. UAC declined) the read just fails.
+    Ev_FileOpsResult opsResult = {};
+    DWORD got = 0;
+    HANDLE evt = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    bool haveResult = ev_OverlappedIo(pipe, evt, false, &opsResult, sizeof(opsResult), got) && (got == sizeof(opsResult));
+    CloseHandle(evt);
+    CloseHandle(pipe);
+
+    if (haveResult && opsResult.failedIndex && opsResult.failedIndex <= ops.size()) {
+        HRESULT Err = HRESULT_FROM_WIN32(opsResult.error);
+        log_error(L"ERROR- elevated file operation #%u failed: %s\nWindows Error 0x%08x - %s\n",
+            opsResult.failedIndex, ev_DescribeFileOp(ops[opsResult.failedIndex-1]).c_str(), Err, HRESULT_to_string(Err).c_str()
+        );
+        return EXIT_FAILURE;
+    }
+    return result;
 }
 
-int ExecAssoc(const std::wstring& executable_fullpath, const ArgContainer& cmdargs, const Ev_ShellExecFlags& flags_in)
-{
-    // Basic rules for executing a program on Windows are according to extension, which might seem odd to
-    // anyone with a strong background in software engineering.  Windows is also structured in such a way
-    // that it's tricky to launch processes directly and have them behave in a desired fashion, due to
-    // filetype associations requiring some amount of command shell variable expansion.
-    //
-    // The first step is determining the correct extension to look up out of the association table.
-    // If a file has _no extension_ then possible matches are created using $PATHEXT.  If any of the
-    // $PATHEXT extensions create a valid existing file, then that file and it's extension are used.
-    //
-    // A typical command shell association looks something like these:
-    //   Msi.Package="%SystemRoot%\System32\msiexec.exe" /i "%1" %*
-    //   sh_auto_file="C:\Program Files\Git\git-bash.exe" --no-cd "%L" %*
-    //
-    //      %1 - is the command itself
-    //      %L - appears to just be an alias for %1
-    //      %* - expands as all other parameters for the command
-    //
-    // The Good News:
-    //   Other types of expansion do _not_ appear to be supported.  For example, %~dp1 is not processed.
-    //   This reduces the scope of complexity to something we can reasonably simulate here.
-    //
+// Load harness (--load-test)
+//
+// Launches many eudo processes against a trivial stub child and reports throughput, latency
+// percentiles and per-launch memory.  Every launch goes through the whole pipeline -- process
+// startup, wmain argument parsing, ExecAssoc and ShellExec -- except the UAC prompt itself, which
+// is stubbed out with --no-elevate so that numbers are reproducible and don't need a human.
+//
+// Latency is measured from CreateProcess to process exit, as seen by the harness.  Memory is the
+// peak committed memory of the launch's job object, which covers eudo and the stub child.  If the
+// harness itself already runs inside a job that can't be nested (Windows 7 and older, or a job
+// that forbids breakaway -- both common under CI), launches can't be given a job of their own and
+// memory is reported as unavailable rather than as zero.
+
+struct Ev_LoadTestConfig {
+    int             launches;
+    int             concurrency;
+    int             argBytes;
+    std::wstring    cmdline;        // what each worker launches, fully formed
+};
 
-    auto extension    = FindBestExt(executable_fullpath);
-    auto exe_fullname = executable_fullpath + extension;
+struct Ev_LoadTestWorker {
+    const Ev_LoadTestConfig*    config;
+    volatile LONG*              next;
+    std::vector<double>         latencyMs;
+    std::vector<SIZE_T>         peakMemory;
+    int                         failures;
+    int                         noJob;          // launches whose memory couldn't be measured
+};
 
-    if (!extension.empty()) {
-        auto strCmd                 = ev_AssocQueryString(ASSOCSTR_COMMAND,         extension.c_str());
+DWORD WINAPI LoadTestWorkerThread(void* param)
+{
+    auto& worker = *(Ev_LoadTestWorker*)param;
+    const auto& config = *worker.config;
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    // eudo itself and the stub are both console apps; keep them from spawning windows or
+    // scribbling on our console.
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, TRUE };
+    HANDLE hNul = CreateFile(L"NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+
+    while (InterlockedIncrement(worker.next) <= config.launches) {
+        std::wstring cmdline = config.cmdline;
+
+        HANDLE hJob = CreateJobObject(nullptr, nullptr);
+
+        STARTUPINFOW si = {};
+        si.cb           = sizeof(si);
+        si.dwFlags      = STARTF_USESTDHANDLES;
+        si.hStdInput    = hNul;
+        si.hStdOutput   = hNul;
+        si.hStdError    = hNul;
+
+        PROCESS_INFORMATION pi = {};
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+
+        if (!CreateProcessW(nullptr, cmdline.data(), nullptr, nullptr, TRUE, CREATE_SUSPENDED | CREATE_NO_WINDOW,
+                nullptr, nullptr, &si, &pi)) {
+            worker.failures += 1;
+            CloseHandle(hJob);
+            continue;
+        }
+        bool inJob = hJob && AssignProcessToJobObject(hJob, pi.hProcess);
+        static volatile LONG s_warnedNoJob = 0;
+        if (!inJob && !InterlockedExchange(&s_warnedNoJob, 1)) {
+            log_error(L"WARN- load test: cannot assign launch to a job object, Windows error 0x%08x; peak memory is unavailable.\n", GetLastError());
+        }
+        ResumeThread(pi.hThread);
 
-        if (g_Verbose) {
-            auto strFriendlyProgramName = ev_AssocQueryString(ASSOCSTR_FRIENDLYAPPNAME, extension.c_str());
-            auto strExe                 = ev_AssocQueryString(ASSOCSTR_EXECUTABLE,      extension.c_str());
-            log_console(L"Assoc FriendlyName = %s\n", strFriendlyProgramName.c_str());
-            log_console(L"Assoc Command      = %s\n", strCmd.c_str());
-            log_console(L"Assoc Exe Fullpath = %s\n", strExe.c_str());
+        DWORD procExitCode = EXIT_FAILURE;
+        WaitForSingleObject(pi.hProcess, INFINITE);
+        QueryPerformanceCounter(&end);
+        GetExitCodeProcess(pi.hProcess, &procExitCode);
+
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION jobInfo = {};
+        if (inJob && QueryInformationJobObject(hJob, JobObjectExtendedLimitInformation, &jobInfo, sizeof(jobInfo), nullptr)) {
+            worker.peakMemory.push_back(jobInfo.PeakJobMemoryUsed);
+        }
+        else {
+            worker.noJob += 1;
         }
 
-        if (strCmd.empty()) {
-            log_error(L"%s: is not an executable program.", executable_fullpath.c_str());
-            _exit(EXIT_FAILURE);
+        worker.latencyMs .push_back(double(end.QuadPart - start.QuadPart) * 1000.0 / double(freq.QuadPart));
+        if (procExitCode != 0) {
+            worker.failures += 1;
         }
 
-        // token replacement time!  Replace %1, %*, %L, etc.
+        CloseHandle(pi.hThread);
+        CloseHandle(pi.hProcess);
+        if (hJob) CloseHandle(hJob);
+    }
 
-        exe_fullname = executable_fullpath;
+    if (hNul != INVALID_HANDLE_VALUE) CloseHandle(hNul);
+    return 0;
+}
 
-        std::wstring CmdLineBuffer;
-        if (1) {
-            int i = 0;
-            while(i < strCmd.length()) {
-                auto curch = (i < strCmd.length()) ? strCmd[i] : L'\0';
-                i += 1;
-                if (!curch) break;
-
-                if (curch == L'%') {
-                    auto nextch = (i < strCmd.length()) ? strCmd[i] : L'\0';
-                    i += 1;
-
-                    switch(nextch)
-                    {
-                        case L'%':
-                            CmdLineBuffer += L'%';
-                        break;
-
-                        case L'L':
-                        case L'l':
-                        case L'1':
-                            CmdLineBuffer += exe_fullname;
-                        break;
-
-                        case L'*':
-                            CmdLineBuffer += xStringJoin(L" ", cmdargs);
-                        break;
-
-                        case L'2': CmdLineBuffer += cmdargs[1]; break;
-                        case L'3': CmdLineBuffer += cmdargs[2]; break;
-                        case L'4': CmdLineBuffer += cmdargs[3]; break;
-                        case L'5': CmdLineBuffer += cmdargs[4]; break;
-                        case L'6': CmdLineBuffer += cmdargs[5]; break;
-                        case L'7': CmdLineBuffer += cmdargs[6]; break;
-                        case L'8': CmdLineBuffer += cmdargs[7]; break;
-                        case L'9': CmdLineBuffer += cmdargs[8]; break;
-
-                        default:
-                            // mimic windows CMD.exe behavior, which is to just output the % unmodified if the command isn't supported.
-                            CmdLineBuffer += L'%';
-                            CmdLineBuffer += curch;
-                        break;
-                    }
-                }
-                else {
-                    CmdLineBuffer += curch;
-                }
-            }
+// spec: <launches>[,<concurrency>[,<argBytes>]]
+// switches, if given, are -c or file operations for the launched eudo to perform in place of a
+// program, eg. to compare --cp against `-c copy`.
+int LoadTest(const WCHAR* spec, const std::wstring& switches, const std::wstring& program, const ArgContainer& cmdargs)
+{
+    Ev_LoadTestConfig config = {};
+    config.launches     = 200;
+    config.concurrency  = 1;
+    swscanf_s(spec, L"%d,%d,%d", &config.launches, &config.concurrency, &config.argBytes);
+
+    if (config.launches < 1 || config.concurrency < 1 || config.concurrency > MAXIMUM_WAIT_OBJECTS || config.argBytes < 0) {
+        log_error(L"ERROR- --load-test=<launches>[,<concurrency 1..%d>[,<argBytes>]]\n", MAXIMUM_WAIT_OBJECTS);
+        return EXIT_FAILURE;
+    }
+
+    // the default stub is ourselves printing a version string: about as cheap as a process gets
+    // while still exercising the full ExecAssoc/ShellExec path for an .exe.
+    auto self = ev_GetModuleFileName();
+    config.cmdline = escape_quotes(self.c_str()) + L" --no-elevate --hide ";
+    if (!switches.empty()) {
+        config.cmdline += switches;
+        if (!cmdargs.empty()) {
+            config.cmdline += L" " + xStringJoin(L" ", cmdargs);
+        }
+    }
+    else if (program.empty()) {
+        config.cmdline += L"-- " + escape_quotes(self.c_str()) + L" --version";
+    }
+    else {
+        config.cmdline += L"-- " + escape_quotes(program.c_str());
+        if (!cmdargs.empty()) {
+            config.cmdline += L" " + xStringJoin(L" ", cmdargs);
         }
+    }
+    if (config.argBytes) {
+        config.cmdline += L" " + std::wstring(config.argBytes, L'x');
+    }
 
-        debug_log(L"Expanded Invocation= %s\n", CmdLineBuffer.c_str());
+    if (config.cmdline.length() >= xMaxEnviron) {
+        log_error(L"ERROR- Command Line too long\n");
+        return EXIT_FAILURE;
+    }
 
-        // ShellExecuteEx needs to have the Application/Command separated from the Command Arguments.
-        // Unfortunately the AssocQueryString returns everything together all-at-once.  Since it's _possible_ the
-        // association does something clever with %1 or %L, it's necessary for us to walk the string and get the
-        // filename out of it.
-        //
-        // Shortcut: use CommandLineToArgvW() and then re-quote the arguments.  It's a bit wasteful on cycles but
-        // it's oh-so-easy and 100% consistent with CMD behavior.
+    log_console(L"Launching %d x `%s` at concurrency %d...\n", config.launches, config.argBytes ? L"(stub + long arg)" : config.cmdline.c_str(), config.concurrency);
 
-        if (1) {
-            int numArgs;
-            auto* reparsed = ::CommandLineToArgvW(CmdLineBuffer.c_str(), &numArgs);
-            if (!reparsed || numArgs <= 0) {
-                log_error(L"ERROR- command line expansion failed.");
-                log_error(L"File type associated as -> %s", strCmd.c_str());
-            }
-            std::wstring reargs;
-            for (int n=1; n<numArgs; ++n) {
-                if (!reargs.empty()) {
-                    reargs += L" ";
-                }
-                reargs += escape_quotes(reparsed[n]);
-            }
-            return ShellExec(reparsed[0], reargs.c_str(), flags_in);
+    volatile LONG next = 0;
+    std::vector<Ev_LoadTestWorker> workers(config.concurrency);
+    std::vector<HANDLE> threads;
+
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    for (auto& worker : workers) {
+        worker.config = &config;
+        worker.next   = &next;
+        if (HANDLE hThread = CreateThread(nullptr, 0, LoadTestWorkerThread, &worker, 0, nullptr)) {
+            threads.push_back(hThread);
         }
     }
-    return ShellExec(exe_fullname.c_str(), xStringJoin(L" ", cmdargs).c_str(), flags_in);
+    WaitForMultipleObjects(DWORD(threads.size()), threads.data(), TRUE, INFINITE);
+    QueryPerformanceCounter(&end);
+
+    for (auto hThread : threads) {
+        CloseHandle(hThread);
+    }
+
+    std::vector<double> latency;
+    SIZE_T memSum   = 0;
+    SIZE_T memMax   = 0;
+    size_t memCount = 0;
+    int    failures = 0;
+    int    noJob    = 0;
+    for (const auto& worker : workers) {
+        latency.insert(latency.end(), worker.latencyMs.begin(), worker.latencyMs.end());
+        for (auto mem : worker.peakMemory) {
+            memSum += mem;
+            memMax  = (mem > memMax) ? mem : memMax;
+        }
+        memCount += worker.peakMemory.size();
+        failures += worker.failures;
+        noJob    += worker.noJob;
+    }
+
+    if (latency.empty()) {
+        log_error(L"ERROR- no launches completed.\n");
+        return EXIT_FAILURE;
+    }
+
+    std::sort(latency.begin(), latency.end());
+    auto pct = [&](double p) { return latency[size_t(p * double(latency.size() - 1) + 0.5)]; };
+
+    double elapsedSec = double(end.QuadPart - start.QuadPart) / double(freq.QuadPart);
+    log_console(
+        L"launches     %d (%d failed)\n"
+        L"elapsed      %.3f s\n"
+        L"throughput   %.1f launches/s\n"
+        L"latency ms   p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+        int(latency.size()), failures,
+        elapsedSec,
+        double(latency.size()) / elapsedSec,
+        pct(0.50), pct(0.90), pct(0.99), latency.back()
+    );
+
+    if (!memCount) {
+        log_console(L"peak mem KB  unavailable (launches could not be placed in a job object)\n");
+    }
+    else {
+        log_console(L"peak mem KB  mean %llu  max %llu%s\n",
+            uint64_t(memSum / memCount / 1024), uint64_t(memMax / 1024),
+            noJob ? xStringFormat(L"  (%d launches unmeasured)", noJob).c_str() : L""
+        );
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 // returns a string description of compiler toolchain and version information
@@ -610,11 +3623,20 @@ std::wstring GetToolchainDesc()
 
 int __cdecl wmain(int Argc, WCHAR* Argv[])
 {
+    auto startTicks     = ev_StatsNow();
+
     Ev_ShellExecFlags shflags = { 0 };
     bool startComspec   = false;
     bool FlagsRead      = false;
     bool showHelp       = false;
     bool showVersion    = false;
+    bool recordStats    = false;
+    bool startPipeline  = false;
+    const WCHAR* loadTestSpec = nullptr;
+    std::vector<Ev_FileOp> fileOps;
+    std::wstring poolHandlers;
+    int  poolIdleSec    = xPoolDefaultIdleSec;
+    int  poolMemMB      = xPoolDefaultMemMB;
 
     // Because CMD shell defers cli parsing to individual applications, there are two ways to process the command line:
     //   A. Parse the original command line ourselves and then feed the original string arguments into ShellExec
@@ -662,6 +3684,17 @@ int __cdecl wmain(int Argc, WCHAR* Argv[])
                 auto switchName = &Argv[i][2];
 
                 if (0) { }      // just for else if code alignment
+                else if (ev_IsFileOpSwitch(switchName)) {
+                    int consumed = ev_ParseFileOp(switchName, Argc, Argv, i, fileOps);
+                    if (consumed < 0) {
+                        return EXIT_FAILURE;
+                    }
+                    i += consumed;
+                }
+                else if (wcscmp(switchName, L"fileops-host") == 0) {
+                    // internal: the elevated half of --cp/--mkdir/--rm/--chmod, see ExecFileOps().
+                    return FileOpsHostMain();
+                }
                 else if (wcscmp(switchName, L"help") == 0) {
                     showHelp = 1;
                 }
@@ -671,12 +3704,74 @@ int __cdecl wmain(int Argc, WCHAR* Argv[])
                 else if (wcscmp(switchName, L"nowait") == 0) {
                     shflags.DoNotWaitForProc = 1;
                 }
+                else if (wcscmp(switchName, L"hide") == 0) {
+                    shflags.HideWindow = 1;
+                }
+                else if (wcscmp(switchName, L"show") == 0) {
+                    shflags.HideWindow = 0;
+                }
+                else if (wcscmp(switchName, L"memo") == 0) {
+                    g_Memo = 1;
+                }
+                else if (wcsncmp(switchName, L"memo-input=", 11) == 0) {
+                    g_Memo = 1;
+                    g_MemoInputs.push_back(switchName + 11);
+                }
+                else if (wcsncmp(switchName, L"memo-env=", 9) == 0) {
+                    g_Memo = 1;
+                    g_MemoEnvNames.push_back(switchName + 9);
+                }
+                else if (wcscmp(switchName, L"no-elevate") == 0) {
+                    shflags.NoElevate = 1;
+                }
+                else if (wcsncmp(switchName, L"load-test=", 10) == 0) {
+                    loadTestSpec = switchName + 10;
+                }
                 else if (wcscmp(switchName, L"version") == 0) {
                     showVersion = 1;
                 }
                 else if (wcscmp(switchName, L"verbose") == 0) {
                     g_Verbose = 1;
                 }
+                else if (wcscmp(switchName, L"pipeline") == 0) {
+                    startPipeline = 1;
+                }
+                else if (wcscmp(switchName, L"pipeline-host") == 0) {
+                    // internal: the elevated half of --pipeline, see ExecPipeline().
+                    return PipelineHostMain();
+                }
+                else if (wcsncmp(switchName, L"pool-start=", 11) == 0) {
+                    poolHandlers = switchName + 11;
+                }
+                else if (wcsncmp(switchName, L"pool-idle=", 10) == 0) {
+                    poolIdleSec = _wtoi(switchName + 10);
+                }
+                else if (wcsncmp(switchName, L"pool-mem=", 9) == 0) {
+                    poolMemMB = _wtoi(switchName + 9);
+                }
+                else if (wcscmp(switchName, L"pool-stop") == 0) {
+                    return PoolStop();
+                }
+                else if (wcsncmp(switchName, L"pool-server=", 12) == 0) {
+                    // internal: the elevated pool, see PoolStart().
+                    return PoolServerMain(switchName + 12);
+                }
+                else if (wcscmp(switchName, L"stats") == 0) {
+                    recordStats = 1;
+                }
+                else if (wcscmp(switchName, L"stats-dump") == 0) {
+                    return StatsDump(nullptr);
+                }
+                else if (wcsncmp(switchName, L"stats-dump=", 11) == 0) {
+                    return StatsDump(switchName + 11);
+                }
+                else if (wcscmp(switchName, L"pty") == 0) {
+                    shflags.PseudoConsole = 1;
+                }
+                else if (wcsncmp(switchName, L"pty-host=", 9) == 0) {
+                    // internal: this is the elevated half of --pty, see ShellExecPty().
+                    return PtyHostMain(switchName + 9);
+                }
                 else {
                     log_error(L"ERROR- Unrecognized Switch `%s`\n", Argv[i]);
                     if (!showHelp) {
@@ -721,11 +3816,12 @@ int __cdecl wmain(int Argc, WCHAR* Argv[])
         }
         else {
             FlagsRead = 1;
-            if (executable_fullpath.empty() && !startComspec) {
+            if (executable_fullpath.empty() && !startComspec && !startPipeline) {
                 executable_fullpath = Argv[i];
             }
             else if (Argv[i] && Argv[i][0]) {
-                auto escaped = escape_quotes(Argv[i]);
+                // pipeline quoting is part of its grammar, and is dealt with by ExecPipeline().
+                auto escaped = startPipeline ? std::wstring(Argv[i]) : escape_quotes(Argv[i]);
                 total_len += int(escaped.length()) + 1;
                 cmd_arguments.push_back(escaped);
 
@@ -759,11 +3855,52 @@ int __cdecl wmain(int Argc, WCHAR* Argv[])
             L" --hide         - Hides the program from view; may not be honored by all programs\n"
             L"                  Hide is ignored when -k is specified.\n"
             L" --show         - Shows program/console window (default)\n"
+            L" --stats        - Records launch phase timings into %%LOCALAPPDATA%%\\eudo\\stats.bin\n"
+            L" --stats-dump[=text|prometheus]\n"
+            L"                - Prints p50/p90/p99 of recorded timings and exits.\n"
+            L" --pty          - Hosts the elevated program in a pseudo console attached to this\n"
+            L"                  terminal, instead of a separate window.  Useful with -k over SSH.\n"
+            L"                  Requires Windows 10 1809 or newer.  Other non-elevated processes\n"
+            L"                  of the same user can attach to this terminal and send input to the\n"
+            L"                  elevated program while it runs.\n"
             L" -k             - Invokes the specified command using CMD /K\n"
             L"                  An interactive CMD prompt will remain open.\n"
             L" -c             - Invokes the specified command using CMD /C\n"
             L"                  This does not offer any specific advantages over normal elevation and\n"
             L"                  is provided primarily for diagnostic purposes\n"
+            L" --pipeline     - Runs the command as a pipeline without CMD: supports |, &&, ||,\n"
+            L"                  <, >, >>, 2>, 2>> and 2>&1.  Stages must be programs or files with\n"
+            L"                  an association; CMD builtins are not available.  Either pass the\n"
+            L"                  whole pipeline as one argument, quoted as the pipeline expects:\n"
+            L"                    eudo --pipeline \"type a.txt | sort\"\n"
+            L"                  or as separate arguments, with operators quoted or escaped from the\n"
+            L"                  calling shell; arguments containing spaces then stay single words:\n"
+            L"                    eudo --pipeline sc query \"My Service\" \"|\" findstr RUNNING\n"
+            L" --pool-start=<ext>:<count>[,<ext>:<count>...]\n"
+            L"                - Elevates a background pool of warm interpreters (python, bash and\n"
+            L"                  PowerShell handlers) and prints EUDO_POOL=..., which must be set in\n"
+            L"                  the environment of later eudo calls to use the pool without a prompt.\n"
+            L"                  While the pool runs, any process of the same user that can read\n"
+            L"                  EUDO_POOL can run scripts elevated without a UAC prompt.\n"
+            L" --pool-idle=<s> - Pool exits after this many idle seconds (default %d)\n"
+            L" --pool-mem=<MB> - Stops pre-starting instances beyond this working set (default %d)\n"
+            L" --pool-stop    - Stops the pool named by %%EUDO_POOL%%\n"
+            L" --memo         - Skips elevation if an identical command already succeeded. The\n"
+            L"                  command line, cwd, and any of the following are part of the match:\n"
+            L" --memo-input=<file>  - contents of <file> (repeatable, implies --memo)\n"
+            L" --memo-env=<name>    - value of environment variable <name> (repeatable, implies --memo)\n"
+            L" --cp <src> <dest>    - Copies a file; dest may be a directory\n"
+            L" --mkdir <dir>        - Creates a directory, including any missing parents\n"
+            L" --rm <path>          - Deletes a file or an empty directory\n"
+            L" --chmod <mode> <path> - Sets/clears attributes; mode is eg. +r, -h, +rh-a\n"
+            L"                  File operations can be repeated and combined; the whole batch runs\n"
+            L"                  in order inside one elevated eudo, without starting CMD.\n"
+            L" --no-elevate   - Runs the program without elevation (diagnostics and load testing)\n"
+            L" --load-test=<launches>[,<concurrency>[,<argBytes>]]\n"
+            L"                - Launches eudo repeatedly with --no-elevate against [program] (default:\n"
+            L"                  eudo --version) and reports launches/sec, latency and memory.\n"
+            L"                  -c <command> or file operations may be given instead of a program,\n"
+            L"                  eg. to compare --cp against -c copy.\n"
             L" --version      - Print app version to STDOUT and exit immediately.\n"
             L" --verbose      - Enables diagnostic logging.\n"
             L"\n"
@@ -773,7 +3910,8 @@ int __cdecl wmain(int Argc, WCHAR* Argv[])
             L"Use `--` to forcibly stop options parsing and begin program and arguments parsing.\n"
             L"This should be used when the target executable filename begins with a dash or double dash.\n"
             L"\n"
-            L"Use -k to open interactive command prompts such as a Visual Studio Tools Prompt.\n"
+            L"Use -k to open interactive command prompts such as a Visual Studio Tools Prompt.\n",
+            xPoolDefaultIdleSec, xPoolDefaultMemMB
         );
 
         return EXIT_SUCCESS;
@@ -799,28 +3937,96 @@ int __cdecl wmain(int Argc, WCHAR* Argv[])
         log_console(
             L"Application        = %s\n"
             L"App Arguments      = %s\n",
-            startComspec ? L"cmd.exe" : executable_fullpath.c_str(),
+            startComspec ? L"cmd.exe" : startPipeline ? L"(pipeline)" : executable_fullpath.c_str(),
             xStringJoin(L" ", cmd_arguments).c_str()
         );
     }
 
+    if (shflags.PseudoConsole && shflags.DoNotWaitForProc) {
+        log_error(L"Warning- --nowait is ignored when --pty is specified.\n");
+        shflags.DoNotWaitForProc = 0;
+    }
+
     if (1) {
         bool willHideWindow = shflags.HideWindow & !(startComspec && shflags.ComspecRemains);
         debug_log(
             L"startComspec       = %c\n"
             L"ComspecRemains     = %c\n"
             L"HideWindow         = %c\n"
-            L"WaitForProcess     = %c\n",
+            L"WaitForProcess     = %c\n"
+            L"PseudoConsole      = %c\n",
             startComspec                ? L'Y' : L'N',
             shflags.ComspecRemains      ? L'Y' : L'N',
             willHideWindow              ? L'Y' : L'N',
-            shflags.DoNotWaitForProc    ? L'N' : L'Y'
+            shflags.DoNotWaitForProc    ? L'N' : L'Y',
+            shflags.PseudoConsole       ? L'Y' : L'N'
         );
     }
 
 
+    if (loadTestSpec) {
+        // launched children only get -c or file operations forwarded; anything else would be
+        // silently dropped and the wrong thing measured.
+        if (startPipeline || shflags.PseudoConsole || g_Memo) {
+            log_error(L"ERROR- --load-test cannot be combined with --pipeline, --pty or --memo\n");
+            return EXIT_FAILURE;
+        }
+        std::wstring switches;
+        if (startComspec) {
+            if (shflags.ComspecRemains) {
+                log_error(L"ERROR- --load-test cannot be combined with -k\n");
+                return EXIT_FAILURE;
+            }
+            switches = L"-c";
+        }
+        for (const auto& op : fileOps) {
+            switches += (switches.empty() ? L"" : L" ") + ev_DescribeFileOp(op);
+        }
+        return LoadTest(loadTestSpec, switches, executable_fullpath, cmd_arguments);
+    }
+
+    if (!poolHandlers.empty()) {
+        return PoolStart(poolHandlers, poolIdleSec, poolMemMB);
+    }
+
+    if (recordStats) {
+        g_StatsStore = ev_StatsOpen(true);
+    }
+
+    if (!fileOps.empty()) {
+        if (startComspec || startPipeline || !executable_fullpath.empty()) {
+            log_error(L"ERROR- file operations cannot be combined with a program, -c|-k or --pipeline\n");
+            return EXIT_FAILURE;
+        }
+        if (g_Memo) {
+            // the host command line carries a fresh result pipe id every run, so a memo key could
+            // never match and would only litter the memo directory.
+            log_error(L"ERROR- file operations cannot be combined with --memo\n");
+            return EXIT_FAILURE;
+        }
+        auto result = ExecFileOps(fileOps, shflags);
+        ev_StatsRecord(StatsPhase_Total, startTicks);
+        return result;
+    }
+
+    if (startPipeline) {
+        if (startComspec) {
+            log_error(L"ERROR- --pipeline cannot be combined with -c|-k\n");
+            return EXIT_FAILURE;
+        }
+        if (cmd_arguments.empty()) {
+            log_error(L"ERROR- --pipeline requires a command.\n");
+            return EXIT_FAILURE;
+        }
+        auto result = ExecPipeline(cmd_arguments, shflags);
+        ev_StatsRecord(StatsPhase_Total, startTicks);
+        return result;
+    }
+
     if (startComspec) {
-        return ExecComspec(cmd_arguments, shflags);
+        auto result = ExecComspec(cmd_arguments, shflags);
+        ev_StatsRecord(StatsPhase_Total, startTicks);
+        return result;
     }
 
     if (executable_fullpath.empty()) {
@@ -829,6 +4035,8 @@ int __cdecl wmain(int Argc, WCHAR* Argv[])
         return EXIT_FAILURE;
     }
 
-    return ExecAssoc(executable_fullpath, cmd_arguments, shflags);
+    auto result = ExecAssoc(executable_fullpath, cmd_arguments, shflags);
+    ev_StatsRecord(StatsPhase_Total, startTicks);
+    return result;
 }
 